@@ -1,9 +1,14 @@
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 #include <linux/spi/spidev.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -13,22 +18,151 @@
 #include <time.h>
 #include <unistd.h>
 
-#define ERROR(message) fprintf(stderr, "%s\n\n", message)
+#define ERROR(message) reportError(message)
+#define FAILURE(message) reportFailure(message)
+
+#define POLL_WINDOW_LIMIT 4096
+#define TRANSFER_LIMIT    4096
+#define BUFFER_ALIGNMENT  64
+
+#define IDENTIFICATION_FREQUENCY 400000
+#define DEFAULT_CARD_FREQUENCY   25000000
+#define DOWNSHIFT_THRESHOLD      4
+#define DOWNSHIFT_WINDOW         256
+
+#define INIT_DEADLINE      1000000
+#define INIT_INTERVAL_MIN  250
+#define INIT_INTERVAL_MAX  16000
+#define INIT_CONDITION     0x000001aa
+
+#define READ_TIMEOUT_LIMIT  100000
+#define WRITE_TIMEOUT_LIMIT 250000
+#define SDHC_WRITE_TIMEOUT  500000
+#define ERASE_TIMEOUT       250000
+#define ERASE_UNIT          8192
+#define ERASE_GRANULE       1024
+#define ERASE_SECOND        1000000
+
+#define BUSY_SLEEP_THRESHOLD 200
+
+#define PROGRESS_INTERVAL 1000000
+#define LATENCY_BUCKETS   256
+
+#define TRACE_CAPACITY 1048576
+#define TRACE_MAGIC    "SDTRACE1"
+
+#define DUMP_LINE_LENGTH 72
+#define DUMP_LINES       64
+
+#define BENCH_OPERATIONS 256
+#define BENCH_SAMPLES    64
+#define BENCH_SIZE_LIMIT 256
+
+#define DIFF_BLOCKS 256
+
+#define MANIFEST_MAGIC       "SDMANIF2"
+#define MANIFEST_HEADER_SIZE 24
+#define MANIFEST_CHUNK_LIMIT 2048
+#define HASH_SEED            0xcbf29ce484222325
+#define HASH_UNKNOWN         0
+
+enum Verbosity
+{
+	Quiet     = 0,
+	Commands  = 1,
+	Responses = 2,
+	Payloads  = 3
+};
 
 volatile sig_atomic_t Interrupted = false;
 
 bool     Interactive    = true;
-bool     Verbose        = true;
+uint8_t  Verbosity      = Payloads;
 char *   Device         = NULL;
 int      Descriptor     = -1;
 uint8_t  Mode           = 0;
 uint8_t  BitsPerWord    = 8;
 uint32_t ClockFrequency = 16000000;
+uint32_t BusFrequency   = IDENTIFICATION_FREQUENCY;
+uint32_t CardFrequency  = DEFAULT_CARD_FREQUENCY;
+bool     AdaptiveClock  = true;
 uint16_t BlockLength    = 512;
-uint32_t PollInterval   = 1000000;
+uint32_t PollInterval   = 10000;
+uint16_t PollWindow     = 16;
 bool     HighCapacity   = false;
 bool     FaultTolerant  = false;
+bool     PreErase       = false;
+bool     Sparse         = false;
+bool     EraseHoles     = false;
+uint32_t ManifestChunk  = 0;
+bool     CheckCRC       = false;
 uint32_t RetryCount     = 0;
+uint16_t RingDepth      = 32;
+uint32_t ClockErrors    = 0;
+uint32_t ClockSamples   = 0;
+
+uint32_t ResponseTimeout = 10000;
+uint32_t ReadTimeout     = READ_TIMEOUT_LIMIT;
+uint32_t WriteTimeout    = SDHC_WRITE_TIMEOUT;
+bool     DeriveTimeouts  = true;
+uint64_t BusyTime        = 0;
+uint32_t EraseCommands   = 0;
+
+struct Residue
+{
+	uint8_t *data;
+	size_t   capacity;
+	size_t   offset;
+	size_t   length;
+};
+
+struct Residue Residue = {0};
+
+struct Scratch
+{
+	uint8_t *data;
+	size_t   capacity;
+};
+
+struct Scratch Scratch = {0};
+
+uint8_t Filler[TRANSFER_LIMIT];
+
+const uint32_t TransferUnits[] = {10000, 100000, 1000000, 10000000};
+const uint32_t TimeValues[] =
+{
+	0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80
+};
+
+uint8_t  CRC7Table[256];
+uint16_t CRC16Table[8][256];
+
+struct Ring
+{
+	uint8_t *       buffer;
+	size_t          depth;
+	size_t          length;
+	size_t          stride;
+	size_t          head;
+	size_t          tail;
+	size_t          count;
+	size_t          transferred;
+	uint64_t        fileTime;
+	bool            stream;
+	bool            ended;
+	bool            sparse;
+	bool            holes;
+	bool            extents;
+	off_t           hole;
+	uint32_t *      runs;
+	bool            closed;
+	int             error;
+	int             wake[2];
+	FILE *          file;
+	pthread_t       thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t  changed;
+};
 
 struct Command 
 {
@@ -49,6 +183,12 @@ enum R1
 	ParameterError = 0x40
 };
 
+struct R2
+{
+	enum R1 r1;
+	uint8_t status;
+};
+
 struct R3
 {
 	enum R1  r1;
@@ -168,13 +308,42 @@ struct CID
 	uint8_t  checksum;
 };
 
+struct SDStatus
+{
+	struct R2 r2;
+	uint8_t   busWidth;
+	bool      securedMode;
+	uint16_t  cardType;
+	uint32_t  protectedSize;
+	uint8_t   speedClass;
+	uint8_t   performanceMove;
+	uint8_t   allocationUnit;
+	uint16_t  eraseSize;
+	uint8_t   eraseTimeout;
+	uint8_t   eraseOffset;
+};
+
+struct SCR
+{
+	enum R1  r1;
+	uint8_t  structure;
+	uint8_t  specification;
+	bool     erasedOnes;
+	uint8_t  security;
+	uint8_t  busWidths;
+	bool     specification3;
+	uint8_t  commandSupport;
+};
+
 enum BlockToken
 {
-	BlockError      = 0x01,
-	BlockCCError    = 0x02,
-	BlockECCFailure = 0x04,
-	BlockOutOfRange = 0x08,
-	BlockStart      = 0xfe
+	BlockError         = 0x01,
+	BlockCCError       = 0x02,
+	BlockECCFailure    = 0x04,
+	BlockOutOfRange    = 0x08,
+	BlockStartMultiple = 0xfc,
+	BlockStopMultiple  = 0xfd,
+	BlockStart         = 0xfe
 };
 
 enum WriteStatus
@@ -192,26 +361,35 @@ struct Block
 	uint8_t *       data;
 	size_t          length;
 	uint16_t        checksum;
+	bool            valid;
 };
 
 enum ResponseType
 {
 	R1,
+	R2,
 	R3,
 	R7,
 	CSD,
 	CID,
 	Status,
-	Block
+	SDStatus,
+	SCR,
+	Block,
+	Stream,
+	R1b
 };
 
 union ResponseData
 {
 	enum   R1    r1;
+	struct R2    r2;
 	struct R3    r3;
 	struct R7    r7;
 	struct CSD   csd;
 	struct CID   cid;
+	struct SDStatus sdStatus;
+	struct SCR   scr;
 	struct Block block;
 };
 
@@ -221,6 +399,105 @@ struct Response
 	union ResponseData data;
 };
 
+struct Card
+{
+	bool       ocrValid;
+	bool       csdValid;
+	bool       cidValid;
+	bool       statusValid;
+	bool       scrValid;
+	uint32_t   ocr;
+	struct CSD csd;
+	struct CID cid;
+	struct SDStatus status;
+	struct SCR scr;
+	uint32_t   busyEstimate;
+};
+
+struct Card Card = {0};
+
+struct Transfer
+{
+	uint64_t start;
+	uint64_t report;
+	uint64_t begun;
+	size_t   count;
+	size_t   blocks;
+	size_t   holes;
+	uint32_t retries;
+	uint32_t bad;
+	uint64_t minimum;
+	uint64_t maximum;
+	uint64_t total;
+	size_t   timed;
+	bool     progressed;
+	uint32_t histogram[LATENCY_BUCKETS];
+};
+
+struct ManifestHeader
+{
+	char     magic[sizeof(MANIFEST_MAGIC) - 1];
+	uint32_t blockLength;
+	uint32_t chunk;
+	uint32_t block;
+	uint32_t count;
+};
+
+struct Manifest
+{
+	FILE *               file;
+	struct ManifestHeader header;
+	uint32_t             filled;
+	bool                 unknown;
+	uint64_t             hash;
+	uint64_t *           hashes;
+	size_t               entries;
+};
+
+struct Statistics
+{
+	uint64_t ioctls;
+	uint64_t bytes;
+	uint64_t spiTime;
+	uint64_t responsePolls;
+	uint64_t tokenPolls;
+	uint64_t busyBytes;
+	uint64_t busyTime;
+	uint64_t crcFailures;
+	uint64_t retries;
+	uint64_t fileTime;
+	uint64_t fileWait;
+};
+
+struct Statistics Statistics = {0};
+
+enum TraceDirection
+{
+	TraceTX = 0,
+	TraceRX = 1
+};
+
+struct TraceRecord
+{
+	uint64_t time;
+	uint16_t length;
+	uint8_t  direction;
+	uint8_t  command;
+	uint32_t reserved;
+};
+
+struct Trace
+{
+	uint8_t *data;
+	uint64_t head;
+	uint64_t tail;
+	bool     enabled;
+	char *   file;
+	uint8_t  command;
+};
+
+struct Trace Trace = {0};
+
 static void interrupt();
 static void interact(void);
 static void displayPrompt(void);
@@ -229,6 +506,9 @@ static int match(char **, char *);
 
 static void displayCommands(void);
 static void displaySessionParameters(void);
+static void displayStatistics(void);
+static void reportError(char *);
+static void reportFailure(char *);
 
 static int acceptCommand0(void);
 static int acceptCommand1(void);
@@ -237,60 +517,194 @@ static int acceptCommand8(char **);
 static int acceptCommand9(void);
 static int acceptCommand10(void);
 static int acceptCommand16(char **);
+static int acceptCommand13(void);
 static int acceptCommand17(char **);
 static int acceptCommand58(void);
 static int acceptApplicationCommand41(char **);
+static int acceptApplicationCommand13(void);
+static int acceptApplicationCommand51(void);
+static int acceptCRCCommand(bool);
 static int acceptRetryCommand(char **);
-static int acceptPushCommand(char **);
+static int acceptWindowCommand(char **);
+static int acceptPollCommand(char **);
+static int acceptTimeoutCommand(char **, uint32_t *);
+static int acceptRingCommand(char **);
+static int acceptPushCommand(char **, bool);
 static int acceptPullCommand(char **);
+static int acceptTuneCommand(char **, bool);
+static int acceptTraceCommand(bool);
+static int acceptTraceSaveCommand(char **);
+static int acceptTraceAutoCommand(char **);
+static int acceptDecodeCommand(char **);
+static int acceptBenchCommand(char **, bool);
+static int acceptEraseCommand(char **);
+static int acceptManifestCommand(char **);
+static int acceptSyncCommand(char **);
+static int acceptInitCommand(void);
 
 static int push(char *, uint32_t);
+static int pushChanges(char *, uint32_t);
+static int storeChanges(uint32_t, uint32_t, uint8_t *, struct Transfer *);
+static int syncImage(char *, char *);
+static int startWrite(uint32_t, uint32_t, bool *);
+static int stopWrite(void);
+static int erase(uint32_t, uint32_t);
+static int eraseBlocks(uint32_t, uint32_t, uint32_t *);
+static int eraseHoles(uint32_t, uint32_t, uint32_t *, struct Transfer *);
+static int writeZeros(uint32_t, uint32_t, struct Transfer *);
+static void alignErase(uint32_t *, uint32_t *);
+static int eraseRange(uint32_t, uint32_t, uint32_t);
+static void planErase(uint32_t *, uint32_t *);
+static int storeBlock(uint32_t, struct Block *, enum WriteStatus *,
+                      uint32_t *, uint32_t);
 static int pull(uint32_t, uint32_t, char *);
+static int startTransmission(uint32_t, struct Block *);
+static int stopTransmission(void);
+static int retrieveBlock(uint32_t, struct Block *, uint32_t *);
+static int tune(uint32_t, uint32_t, uint32_t, bool);
+static int identify(void);
+static int awaitReady(uint8_t, uint32_t, enum R1 *);
+static uint64_t now(void);
+static int sampleBlocks(uint32_t, uint32_t, uint8_t *, bool, uint32_t *);
+static int bench(uint32_t, uint32_t, bool);
+static int benchSequential(char *, uint32_t, uint32_t, uint32_t, bool,
+                           uint8_t *);
+static int benchRandom(char *, uint32_t, uint32_t, uint32_t, bool,
+                       uint8_t *);
+static int benchCommand(uint8_t, uint32_t, uint8_t *);
+static int readBlocks(uint32_t, uint32_t, uint8_t *);
+static int writeBlocks(uint32_t, uint32_t, uint8_t *);
+static int writeRun(uint32_t, uint32_t, uint8_t *, uint32_t *);
+static int failStop(void);
+static uint32_t blockAddress(uint32_t);
+static void reportBench(char *, size_t, struct Transfer *);
 static void nextBlock(uint32_t *);
 static int countBlocks(FILE *, size_t *);
 static void printBadBlockWarning(uint32_t);
+static void beginTransfer(struct Transfer *, size_t);
+static void beginBlock(struct Transfer *);
+static void endBlock(struct Transfer *, uint32_t);
+static void reportProgress(struct Transfer *);
+static void endTransfer(struct Transfer *, char *);
+static size_t bucketLatency(uint64_t);
+static uint64_t measureLatency(struct Transfer *, double);
+
+static int openRing(struct Ring *, FILE *, void *(*)(void *));
+static int closeRing(struct Ring *);
+static void sealRing(struct Ring *);
+static void closeWake(struct Ring *);
+static void abandonRing(struct Ring *, int);
+static uint8_t *claimSlot(struct Ring *);
+static void fillSlot(struct Ring *);
+static uint8_t *drainSlot(struct Ring *);
+static void releaseSlot(struct Ring *);
+static void *writeRing(void *);
+static void *readRing(void *);
+static int skipSlot(struct Ring *, uint8_t *);
+static size_t readSlot(struct Ring *, uint8_t *);
+static size_t readStream(struct Ring *, uint8_t *);
+static uint32_t skipHole(struct Ring *);
+static uint32_t slotRun(struct Ring *);
+static bool copySlot(struct Ring *, uint32_t *, uint8_t *);
+static bool isZeroBlock(uint8_t *, size_t);
+
+static int openManifest(struct Manifest *, char *, uint32_t, uint32_t);
+static void addManifest(struct Manifest *, uint8_t *, bool);
+static int closeManifest(struct Manifest *);
+static int writeManifest(FILE *, struct ManifestHeader *);
+static int readManifest(FILE *, struct ManifestHeader *);
+static int writeHash(FILE *, uint64_t);
+static int readHash(FILE *, uint64_t *);
+static void encodeLittleEndian(uint8_t *, uint64_t, size_t);
+static uint64_t decodeLittleEndian(uint8_t *, size_t);
+static uint64_t hashBlock(uint8_t *, size_t, uint64_t);
+static uint64_t finishHash(uint64_t);
+static uint64_t mixHash(uint64_t);
 
 static int setMode(void);
 static int setBitsPerWord(void);
 static int parseClockFrequency(char *);
 static int setClockFrequency(void);
+static void slowClock(void);
+static void rampClock(void);
+static void adaptClock(bool);
+static uint32_t decodeTransferRate(uint8_t);
+static void deriveTimeouts(void);
 static int parseDevice(char *);
 static int openDevice(void);
 static bool isDeviceOpen(void);
 static void closeDevice(void);
 
 static int receiveData(uint8_t *, size_t);
-static int transmitData(uint8_t *, size_t);
-static int exchangeData(struct spi_ioc_transfer *);
+static int awaitData(uint8_t, uint8_t *, size_t, uint32_t, uint64_t *);
+static int awaitBusy(bool);
+static int skipData(size_t);
+static int pollData(size_t);
+static int clockData(uint8_t *, size_t);
+static int collectData(uint8_t *, size_t, size_t);
+static int reserveResidue(size_t);
+static void discardResidue(void);
+static uint8_t *reserveScratch(size_t);
+static int transmitData(uint8_t *, size_t, size_t);
+static int transmitSegments(struct spi_ioc_transfer *, size_t, size_t);
+static int exchangeData(struct spi_ioc_transfer *, size_t);
+
+static void traceTransfers(struct spi_ioc_transfer *, size_t, uint64_t);
+static void traceData(uint8_t, uint8_t *, size_t, uint64_t);
+static void writeTrace(void *, size_t);
+static void readTrace(uint64_t, void *, size_t);
+static int saveTrace(char *);
+static void flushTrace(void);
+static int decode(char *);
+static bool isCommandRecord(struct TraceRecord *, uint8_t *);
+static void decodeResponse(struct Command *, uint8_t *, size_t);
+static void decodeBlocks(uint8_t, uint8_t *, size_t);
+static void decodeWriteStatus(uint8_t *, size_t);
 
 static int command(uint8_t, uint32_t,
                    enum ResponseType, struct Response *);
-static int transmitCommand(uint8_t, uint32_t);
+static int transmitCommand(uint8_t, uint32_t, size_t);
+static size_t measureResponse(enum ResponseType);
 static void serialiseCommand(struct Command *, uint8_t *);
 
 static uint8_t calculateCRC7(uint8_t *, size_t);
 static void calculateCRC16(uint8_t *, size_t, uint16_t *);
+static void initialiseCRC(void);
 
 static int receiveResponse(enum ResponseType, struct Response *);
 static int receiveR1(enum R1 *);
+static int receiveR1b(enum R1 *);
+static int receiveR2(struct R2 *);
 static int receiveR3(struct R3 *);
 static int receiveR7(struct R7 *);
 static int receiveCSD(struct CSD *);
 static int receiveCID(struct CID *);
+static int receiveSDStatus(struct SDStatus *);
+static int receiveSCR(struct SCR *);
+static void parseCSD(uint8_t *, struct CSD *);
+static void parseCID(uint8_t *, struct CID *);
+static void parseSDStatus(uint8_t *, struct SDStatus *);
+static void parseSCR(uint8_t *, struct SCR *);
 static int receiveBlock(size_t, struct Block *);
+static int receiveStreamBlock(size_t, struct Block *);
+static int receiveDataBlock(size_t, struct Block *);
 
 static int transmitBlock(struct Block *);
 static int receiveWriteStatus(enum WriteStatus *);
 
 static void dumpCommand(struct Command *);
 static void dumpR1(enum R1 *);
+static void dumpR2(struct R2 *);
 static void dumpR3(struct R3 *);
 static void dumpR7(struct R7 *);
 static void dumpCSD(struct CSD *);
 static void dumpCSD1(struct CSD1 *);
 static void dumpCSD2(struct CSD2 *);
 static void dumpCID(struct CID *);
+static void dumpSDStatus(struct SDStatus *);
+static void dumpSCR(struct SCR *);
 static void dumpWriteStatus(enum WriteStatus *);
+static void dumpBlock(char *, struct Block *);
 static void displayBlockToken(struct Block *);
 static void displayBlockChecksum(struct Block *);
 static void displayString(char *, char *);
@@ -300,6 +714,11 @@ static void displayVersion(char *, uint8_t, uint8_t);
 static void displayFlag(char *, uint8_t);
 static void displayFrequency(char *, uint32_t);
 static void displayMiliseconds(char *, uint32_t);
+static void displayMicroseconds(char *, uint64_t);
+static void displayCount(char *, uint64_t);
+static void displayVerbosity(char *, uint8_t);
+static void displayBytes(char *, uint64_t);
+static void displayBlocks(char *, uint32_t);
 static void display8(char *, uint8_t);
 static void describe8(char *, uint8_t, char *);
 static void display16(char *, uint16_t);
@@ -315,6 +734,8 @@ static int parseFilename(char **, char **);
 
 int main(int argc, char *argv[])
 {
+	memset(Filler, 0xff, sizeof(Filler));
+	initialiseCRC();
 	interact();
 	return EXIT_SUCCESS;
 }
@@ -362,12 +783,22 @@ static void parseCommand(char *cursor)
 
 	else if (match(&cursor, "verbose\n") == 0)
 	{
-		Verbose = true;
+		Verbosity = Payloads;
+	}
+
+	else if (match(&cursor, "verbose commands\n") == 0)
+	{
+		Verbosity = Commands;
+	}
+
+	else if (match(&cursor, "verbose responses\n") == 0)
+	{
+		Verbosity = Responses;
 	}
 
 	else if (match(&cursor, "quiet\n") == 0)
 	{
-		Verbose = false;
+		Verbosity = Quiet;
 	}
 
 	else if (match(&cursor, "bye\n") == 0)
@@ -380,6 +811,16 @@ static void parseCommand(char *cursor)
 		displaySessionParameters();
 	}
 
+	else if (match(&cursor, "stats?\n") == 0)
+	{
+		displayStatistics();
+	}
+
+	else if (match(&cursor, "stats reset\n") == 0)
+	{
+		memset(&Statistics, 0, sizeof(Statistics));
+	}
+
 	else if (match(&cursor, "clock ") == 0)
 	{
 		if (parseClockFrequency(cursor) == -1)
@@ -391,6 +832,11 @@ static void parseCommand(char *cursor)
 		{
 			ERROR(strerror(errno));
 		}
+
+		else if (!AdaptiveClock || BusFrequency > ClockFrequency)
+		{
+			BusFrequency = ClockFrequency;
+		}
 	}
 
 	else if (match(&cursor, "open ") == 0)
@@ -446,6 +892,11 @@ static void parseCommand(char *cursor)
 		acceptCommand16(&cursor);
 	}
 
+	else if (match(&cursor, "cmd13\n") == 0)
+	{
+		acceptCommand13();
+	}
+
 	else if (match(&cursor, "cmd17 ") == 0)
 	{
 		acceptCommand17(&cursor);
@@ -461,6 +912,21 @@ static void parseCommand(char *cursor)
 		acceptApplicationCommand41(&cursor);
 	}
 
+	else if (match(&cursor, "acmd13\n") == 0)
+	{
+		acceptApplicationCommand13();
+	}
+
+	else if (match(&cursor, "acmd51\n") == 0)
+	{
+		acceptApplicationCommand51();
+	}
+
+	else if (match(&cursor, "init\n") == 0)
+	{
+		acceptInitCommand();
+	}
+
 	else if (match(&cursor, "fault tolerant\n") == 0)
 	{
 		FaultTolerant = true;
@@ -471,14 +937,117 @@ static void parseCommand(char *cursor)
 		FaultTolerant = false;
 	}
 
+	else if (match(&cursor, "pre-erase on\n") == 0)
+	{
+		PreErase = true;
+	}
+
+	else if (match(&cursor, "pre-erase off\n") == 0)
+	{
+		PreErase = false;
+	}
+
+	else if (match(&cursor, "sparse on\n") == 0)
+	{
+		Sparse = true;
+	}
+
+	else if (match(&cursor, "sparse off\n") == 0)
+	{
+		Sparse = false;
+	}
+
+	else if (match(&cursor, "holes skip\n") == 0)
+	{
+		EraseHoles = false;
+	}
+
+	else if (match(&cursor, "holes erase\n") == 0)
+	{
+		EraseHoles = true;
+	}
+
+	else if (match(&cursor, "manifest off\n") == 0)
+	{
+		ManifestChunk = 0;
+	}
+
+	else if (match(&cursor, "manifest ") == 0)
+	{
+		acceptManifestCommand(&cursor);
+	}
+
+	else if (match(&cursor, "crc on\n") == 0)
+	{
+		acceptCRCCommand(true);
+	}
+
+	else if (match(&cursor, "crc off\n") == 0)
+	{
+		acceptCRCCommand(false);
+	}
+
+	else if (match(&cursor, "auto-clock on\n") == 0)
+	{
+		AdaptiveClock = true;
+		rampClock();
+	}
+
+	else if (match(&cursor, "auto-clock off\n") == 0)
+	{
+		AdaptiveClock = false;
+		BusFrequency  = ClockFrequency;
+	}
+
 	else if (match(&cursor, "retry ") == 0)
 	{
 		acceptRetryCommand(&cursor);
 	}
 
+	else if (match(&cursor, "window ") == 0)
+	{
+		acceptWindowCommand(&cursor);
+	}
+
+	else if (match(&cursor, "poll ") == 0)
+	{
+		acceptPollCommand(&cursor);
+	}
+
+	else if (match(&cursor, "timeout response ") == 0)
+	{
+		acceptTimeoutCommand(&cursor, &ResponseTimeout);
+	}
+
+	else if (match(&cursor, "timeout read ") == 0)
+	{
+		acceptTimeoutCommand(&cursor, &ReadTimeout);
+	}
+
+	else if (match(&cursor, "timeout write ") == 0)
+	{
+		acceptTimeoutCommand(&cursor, &WriteTimeout);
+	}
+
+	else if (match(&cursor, "timeout auto\n") == 0)
+	{
+		DeriveTimeouts = true;
+		deriveTimeouts();
+	}
+
+	else if (match(&cursor, "ring ") == 0)
+	{
+		acceptRingCommand(&cursor);
+	}
+
+	else if (match(&cursor, "push --diff ") == 0)
+	{
+		acceptPushCommand(&cursor, true);
+	}
+
 	else if (match(&cursor, "push ") == 0)
 	{
-		acceptPushCommand(&cursor);
+		acceptPushCommand(&cursor, false);
 	}
 
 	else if (match(&cursor, "pull ") == 0)
@@ -486,6 +1055,61 @@ static void parseCommand(char *cursor)
 		acceptPullCommand(&cursor);
 	}
 
+	else if (match(&cursor, "tune set ") == 0)
+	{
+		acceptTuneCommand(&cursor, true);
+	}
+
+	else if (match(&cursor, "tune ") == 0)
+	{
+		acceptTuneCommand(&cursor, false);
+	}
+
+	else if (match(&cursor, "bench write ") == 0)
+	{
+		acceptBenchCommand(&cursor, true);
+	}
+
+	else if (match(&cursor, "bench ") == 0)
+	{
+		acceptBenchCommand(&cursor, false);
+	}
+
+	else if (match(&cursor, "erase ") == 0)
+	{
+		acceptEraseCommand(&cursor);
+	}
+
+	else if (match(&cursor, "sync ") == 0)
+	{
+		acceptSyncCommand(&cursor);
+	}
+
+	else if (match(&cursor, "trace on\n") == 0)
+	{
+		acceptTraceCommand(true);
+	}
+
+	else if (match(&cursor, "trace off\n") == 0)
+	{
+		acceptTraceCommand(false);
+	}
+
+	else if (match(&cursor, "trace save ") == 0)
+	{
+		acceptTraceSaveCommand(&cursor);
+	}
+
+	else if (match(&cursor, "trace auto ") == 0)
+	{
+		acceptTraceAutoCommand(&cursor);
+	}
+
+	else if (match(&cursor, "decode ") == 0)
+	{
+		acceptDecodeCommand(&cursor);
+	}
+
 	else
 	{
 		ERROR("Unrecognised command");
@@ -509,10 +1133,14 @@ static void displayCommands(void)
 {
 	displayString("?", "Display commands");
 	displayString("session?", "Display session parameters");
+	displayString("stats?", "Display transfer statistics");
+	displayString("stats reset", "Reset transfer statistics");
 	displayString("verbose", "Be verbose (default)");
+	displayString("verbose commands", "Show commands only");
+	displayString("verbose responses", "Show commands and responses");
 	displayString("quiet", "Be quiet");
 	displayString("bye", "Leave sdmmc/spi\n");
-	displayString("clock FREQUENCY", "Set SPI clock frequency");
+	displayString("clock FREQUENCY", "Set maximum SPI clock frequency");
 	displayString("open FILENAME", "Open SPI device");
 	displayString("close", "Close SPI device\n");
 	displayString("cmd0", "Go to Idle State");
@@ -522,34 +1150,116 @@ static void displayCommands(void)
 	displayString("cmd9", "Read CSD Register");
 	displayString("cmd10", "Read CID Register");
 	displayString("cmd16 LENGTH", "Set Block Length");
+	displayString("cmd13", "Send Status");
 	displayString("cmd17 ADDRESS", "Read Single Block");
 	displayString("cmd58", "Read Operating Condition");
-	displayString("acmd41 CONDITION", "Send Operating Condition\n");
+	displayString("acmd41 CONDITION", "Send Operating Condition");
+	displayString("acmd13", "Send SD Status");
+	displayString("acmd51", "Send SD Configuration Register");
+	displayString("init", "Identify and initialise card\n");
 	displayString("fault tolerant", "Pad and skip block on error");
 	displayString("fault intolerant", "Abort on block error");
-	displayString("retry COUNT", "Set block retry count\n");
+	displayString("pre-erase on", "Pre-erase blocks before push");
+	displayString("pre-erase off", "Push without pre-erase (default)");
+	displayString("sparse on", "Transfer zero blocks as holes");
+	displayString("sparse off", "Transfer every block as data (default)");
+	displayString("holes skip", "Leave holes unwritten on push (default)");
+	displayString("holes erase", "Erase holes on push");
+	displayString("manifest CHUNK", "Hash every CHUNK blocks on pull");
+	displayString("manifest off", "Pull without manifest (default)");
+	displayString("crc on", "Check data CRC (cmd59)");
+	displayString("crc off", "Ignore data CRC (default)");
+	displayString("auto-clock on", "Adapt clock to card (default)");
+	displayString("auto-clock off", "Run at the set clock frequency");
+	displayString("retry COUNT", "Set block retry count");
+	displayString("window SIZE", "Set response poll window");
+	displayString("poll INTERVAL", "Set initialisation poll interval");
+	displayString("timeout response TIME", "Set response timeout");
+	displayString("timeout read TIME", "Set read data timeout");
+	displayString("timeout write TIME", "Set write busy timeout");
+	displayString("timeout auto", "Derive timeouts from CSD (default)");
+	displayString("ring DEPTH", "Set file I/O ring depth\n");
 	displayString("push FILE BLOCK", "Push blocks to card");
-	displayString("pull BLOCK COUNT FILE", "Pull blocks from card\n");
+	displayString("push --diff FILE BLOCK", "Push changed blocks only");
+	displayString("sync IMAGE MANIFEST", "Push blocks changed since pull");
+	displayString("pull BLOCK COUNT FILE", "Pull blocks from card");
+	displayString("tune BLOCK COUNT [HZ]", "Sweep clock frequencies");
+	displayString("tune set BLOCK COUNT [HZ]", "Sweep and keep fastest clock");
+	displayString("bench BLOCK COUNT", "Benchmark reads");
+	displayString("bench write BLOCK COUNT", "Benchmark reads and writes");
+	displayString("erase BLOCK COUNT", "Erase blocks on card\n");
+	displayString("trace on", "Record SPI transactions");
+	displayString("trace off", "Stop recording (default)");
+	displayString("trace save FILE", "Save recorded transactions");
+	displayString("trace auto FILE", "Record and save on error");
+	displayString("decode FILE", "Decode saved transactions\n");
 }
 
 static void displaySessionParameters(void)
 {
 	displayString("Device", Device);
 	displayFrequency("Clock Frequency", ClockFrequency);
+	displayFrequency("Bus Frequency", BusFrequency);
+	displayString("Adaptive Clock?", AdaptiveClock ? "Yes" : "No");
 	displayMiliseconds("Poll Interval", PollInterval / 1000);
+	displayMicroseconds("Response Timeout", ResponseTimeout);
+	displayMicroseconds("Read Timeout", ReadTimeout);
+	displayMicroseconds("Write Timeout", WriteTimeout);
+	displayString("Derived Timeouts?", DeriveTimeouts ? "Yes" : "No");
+	displayBytes("Poll Window", PollWindow);
+	displayBlocks("Ring Depth", RingDepth);
 	displayString("Fault Tolerant?", FaultTolerant ? "Yes" : "No");
+	displayString("Pre-erase?", PreErase ? "Yes" : "No");
+	displayString("Sparse?", Sparse ? "Yes" : "No");
+	displayString("Erase Holes?", EraseHoles ? "Yes" : "No");
+	displayBlocks("Manifest Chunk", ManifestChunk);
+	displayString("CRC Checked?", CheckCRC ? "Yes" : "No");
 	display8("Retry Count", RetryCount);
 	displayString("High Capacity?", HighCapacity ? "Yes" : "No");
+	displayVerbosity("Verbosity", Verbosity);
+	displayString("Trace?", Trace.enabled ? "Yes" : "No");
+	displayString("Trace File", Trace.file ? Trace.file : "None");
+	putchar('\n');
+}
+
+static void displayStatistics(void)
+{
+	displayCount("SPI Transfers", Statistics.ioctls);
+	displayCount("SPI Bytes", Statistics.bytes);
+	displayMicroseconds("SPI Time", Statistics.spiTime);
+	displayCount("Response Poll Bytes", Statistics.responsePolls);
+	displayCount("Token Poll Bytes", Statistics.tokenPolls);
+	displayCount("Busy Poll Bytes", Statistics.busyBytes);
+	displayMicroseconds("Busy Time", Statistics.busyTime);
+	displayCount("CRC Failures", Statistics.crcFailures);
+	displayCount("Retries", Statistics.retries);
+	displayMicroseconds("File Time", Statistics.fileTime);
+	displayMicroseconds("File Wait", Statistics.fileWait);
 	putchar('\n');
 }
 
+static void reportError(char *message)
+{
+	fprintf(stderr, "%s\n\n", message);
+}
+
+static void reportFailure(char *message)
+{
+	reportError(message);
+	flushTrace();
+}
+
 static int acceptCommand0(void)
 {
 	struct Response response;
 
+	slowClock();
+	memset(&Card, 0, sizeof(Card));
+	deriveTimeouts();
+
 	if (command(0, 0, R1, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -559,18 +1269,74 @@ static int acceptCommand0(void)
 static int acceptCommand1(void)
 {
 	struct Response response;
+	uint64_t deadline = now() + INIT_DEADLINE;
 
-	do
+	while (true)
 	{
 		if (command(1, 0, R1, &response) == -1)
 		{
-			ERROR(strerror(errno));
+			FAILURE(strerror(errno));
+			return -1;
+		}
+
+		if (response.data.r1 != Idle)
+		{
+			break;
+		}
+
+		if (now() >= deadline)
+		{
+			FAILURE(strerror(ETIMEDOUT));
 			return -1;
 		}
 
 		usleep(PollInterval);
 	}
-	while (response.data.r1 != Ready);
+
+	if (response.data.r1 != Ready)
+	{
+		FAILURE(strerror(ENODEV));
+		return -1;
+	}
+
+	rampClock();
+	return 0;
+}
+
+static int acceptApplicationCommand13(void)
+{
+	struct Response response;
+
+	if (command(55, 0, R1, &response) == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (command(13, 0, SDStatus, &response) == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int acceptApplicationCommand51(void)
+{
+	struct Response response;
+
+	if (command(55, 0, R1, &response) == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (command(51, 0, SCR, &response) == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
 
 	return 0;
 }
@@ -588,7 +1354,7 @@ static int acceptCommand6(char **cursor)
 
 	if (command(6, data, Status, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -608,7 +1374,7 @@ static int acceptCommand8(char **cursor)
 
 	if (command(8, data, R7, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -621,7 +1387,7 @@ static int acceptCommand9(void)
 
 	if (command(9, 0, CSD, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -634,7 +1400,7 @@ static int acceptCommand10(void)
 
 	if (command(10, 0, CID, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -653,7 +1419,20 @@ static int acceptCommand16(char **cursor)
 
 	if (command(16, BlockLength, R1, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int acceptCommand13(void)
+{
+	struct Response response;
+
+	if (command(13, 0, R2, &response) == -1)
+	{
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -673,11 +1452,10 @@ static int acceptCommand17(char **cursor)
 
 	if (command(17, data, Block, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
-	free(response.data.block.data);
 	return 0;
 }
 
@@ -687,7 +1465,7 @@ static int acceptCommand58(void)
 
 	if (command(58, 0, R3, &response) == -1)
 	{
-		ERROR(strerror(errno));
+		FAILURE(strerror(errno));
 		return -1;
 	}
 
@@ -698,6 +1476,7 @@ static int acceptApplicationCommand41(char **cursor)
 {
 	struct Response response;
 	uint32_t data = 0;
+	uint64_t deadline = 0;
 
 	if (parseUInt32(cursor, &data) == -1)
 	{
@@ -705,23 +1484,73 @@ static int acceptApplicationCommand41(char **cursor)
 		return -1;
 	}
 
-	do
+	deadline = now() + INIT_DEADLINE;
+
+	while (true)
 	{
 		if (command(55, 0, R1, &response) == -1)
 		{
-			ERROR(strerror(errno));
+			FAILURE(strerror(errno));
 			return -1;
 		}
 
 		if (command(41, data, R1, &response) == -1)
 		{
-			ERROR(strerror(errno));
+			FAILURE(strerror(errno));
+			return -1;
+		}
+
+		if (response.data.r1 != Idle)
+		{
+			break;
+		}
+
+		if (now() >= deadline)
+		{
+			FAILURE(strerror(ETIMEDOUT));
 			return -1;
 		}
 
 		usleep(PollInterval);
 	}
-	while (response.data.r1 != Ready);
+
+	if (response.data.r1 != Ready)
+	{
+		FAILURE(strerror(ENODEV));
+		return -1;
+	}
+
+	rampClock();
+	return 0;
+}
+
+static int acceptCRCCommand(bool enable)
+{
+	struct Response response;
+
+	if (command(59, enable, R1, &response) == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if ((response.data.r1 & ~Idle) != Ready)
+	{
+		FAILURE("CRC mode rejected");
+		return -1;
+	}
+
+	CheckCRC = enable;
+	return 0;
+}
+
+static int acceptInitCommand(void)
+{
+	if (identify() == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
 
 	return 0;
 }
@@ -731,7 +1560,65 @@ static int acceptRetryCommand(char **cursor)
 	return parseUInt32(cursor, &RetryCount);
 }
 
-static int acceptPushCommand(char **cursor)
+static int acceptWindowCommand(char **cursor)
+{
+	uint16_t window = 0;
+
+	if (parseUInt16(cursor, &window) == -1 ||
+	    window == 0 || window > POLL_WINDOW_LIMIT)
+	{
+		ERROR("Invalid poll window");
+		return -1;
+	}
+
+	PollWindow = window;
+	return 0;
+}
+
+static int acceptPollCommand(char **cursor)
+{
+	uint32_t interval = 0;
+
+	if (parseUInt32(cursor, &interval) == -1 || interval > 60000)
+	{
+		ERROR("Invalid poll interval");
+		return -1;
+	}
+
+	PollInterval = interval * 1000;
+	return 0;
+}
+
+static int acceptTimeoutCommand(char **cursor, uint32_t *timeout)
+{
+	uint32_t value = 0;
+
+	if (parseUInt32(cursor, &value) == -1 || value == 0)
+	{
+		ERROR("Invalid timeout");
+		return -1;
+	}
+
+	*timeout = value;
+	DeriveTimeouts = false;
+	return 0;
+}
+
+static int acceptRingCommand(char **cursor)
+{
+	uint16_t depth = 0;
+
+	if (parseUInt16(cursor, &depth) == -1 || depth == 0)
+	{
+		ERROR("Invalid ring depth");
+		return -1;
+	}
+
+	RingDepth = depth;
+	return 0;
+}
+
+static int acceptPushCommand(char **cursor, bool changes)
 {
 	char *filename = NULL;
 	uint32_t address = 0;
@@ -748,7 +1635,7 @@ static int acceptPushCommand(char **cursor)
 		return -1;
 	}
 
-	return push(filename, address);
+	return changes ? pushChanges(filename, address) : push(filename, address);
 }
 
 static int acceptPullCommand(char **cursor)
@@ -778,478 +1665,4369 @@ static int acceptPullCommand(char **cursor)
 	return pull(address, count, filename);
 }
 
-static int push(char *filename, uint32_t address)
+static int acceptTuneCommand(char **cursor, bool apply)
 {
-	int status = 0;
-	int retries = 0;
-	int delta = 0;
-	size_t index = 0;
-	size_t count = 0;
-	size_t length = 0;
-	time_t start, end;
-	uint8_t buffer[BlockLength]; 
-	struct Block block = {0};
-	struct Response response = {0};
-	enum WriteStatus writeStatus = NotWritten;
-	FILE *file = NULL;
-
-	start = time(NULL);
-	file = fopen(filename, "r");
+	uint32_t address = 0;
+	uint32_t count = 0;
+	uint32_t ceiling = 0;
 
-	if (file == NULL)
+	if (parseUInt32(cursor, &address) == -1)
 	{
-		ERROR(strerror(errno));
+		ERROR("Invalid address");
 		return -1;
 	}
 
-	if (countBlocks(file, &count) == -1)
+	if (parseUInt32(cursor, &count) == -1 || count == 0)
 	{
-		ERROR(strerror(errno));
+		ERROR("Invalid count");
 		return -1;
 	}
 
-	if (!HighCapacity)
+	while (isspace(**cursor))
 	{
-		address *= BlockLength;
+		(*cursor)++;
 	}
 
-	signal(SIGINT, interrupt);
-
-	while (index < count)
+	if (**cursor != 0 && (parseUInt32(cursor, &ceiling) == -1 || ceiling == 0))
 	{
-		memset(buffer, 0, sizeof(buffer));
-		length = fread(buffer, 1, sizeof(buffer), file);
-
-		if (length < BlockLength)
-		{
-			if (ferror(file))
-			{
-				status = -1;
-				ERROR(strerror(errno));
-				break;
-			}
+		ERROR("Invalid frequency");
+		return -1;
+	}
 
-			if (feof(file))
-			{
-				status = -1;
-				ERROR("File truncated");
-				break;
-			}
-		}
+	return tune(address, count, ceiling, apply);
+}
 
-		block.token  = BlockStart;
-		block.data   = buffer;
-		block.length = sizeof(buffer);
+static int acceptBenchCommand(char **cursor, bool writable)
+{
+	uint32_t address = 0;
+	uint32_t count = 0;
 
-		if (command(24, address, R1, &response) == -1)
-		{
-			status = -1;
-			ERROR(strerror(errno));
-			break;
-		}
+	if (parseUInt32(cursor, &address) == -1)
+	{
+		ERROR("Invalid address");
+		return -1;
+	}
 
-		if (response.data.r1 != Ready)
-		{
-			if (retries < RetryCount)
-			{
-				retries++;
-				continue;
-			}
+	if (parseUInt32(cursor, &count) == -1 || count == 0)
+	{
+		ERROR("Invalid count");
+		return -1;
+	}
 
-			else
-			{
-				printBadBlockWarning(address);
-				retries = 0;
-				break;
-			}
-		}
+	return bench(address, count, writable);
+}
 
-		if (transmitBlock(&block) == -1)
-		{
-			status = -1;
-			ERROR(strerror(errno));
-			break;
-		}
+static int acceptEraseCommand(char **cursor)
+{
+	uint32_t address = 0;
+	uint32_t count = 0;
 
-		if (receiveWriteStatus(&writeStatus) == -1)
-		{
-			status = -1;
-			ERROR(strerror(errno));
-			break;
-		}
+	if (parseUInt32(cursor, &address) == -1)
+	{
+		ERROR("Invalid address");
+		return -1;
+	}
 
-		if (writeStatus != WriteAccepted)
-		{
-			if (retries < RetryCount)
-			{
-				retries++;
-				continue;
-			}
+	if (parseUInt32(cursor, &count) == -1 || count == 0)
+	{
+		ERROR("Invalid count");
+		return -1;
+	}
 
-			else
-			{
-				printBadBlockWarning(address);
-				retries = 0;
-				break;
-			}
-		}
+	return erase(address, count);
+}
 
-		if (Interrupted)
-		{
-			Interrupted = false;
-			break;
-		}
+static int acceptManifestCommand(char **cursor)
+{
+	uint32_t chunk = 0;
 
-		nextBlock(&address);
-		index++;
+	if (parseUInt32(cursor, &chunk) == -1 || chunk == 0 ||
+	    chunk > MANIFEST_CHUNK_LIMIT)
+	{
+		ERROR("Invalid chunk size");
+		return -1;
 	}
 
-	fclose(file);
-	signal(SIGINT, SIG_DFL);
-
-	end = time(NULL);
-	delta = difftime(end, start) + 1;
-	printf("Pushed %d of %d block(s) in +-%ds\n\n", index, count, delta);
-
-	return status;
+	ManifestChunk = chunk;
+	return 0;
 }
 
-static int pull(uint32_t address, uint32_t count, char *filename)
+static int acceptSyncCommand(char **cursor)
 {
-	int status = 0;
-	int retries = 0;
-	int delta = 0;
-	uint32_t index = 0;
-	time_t start, end;
-	struct Response response;
-	struct Block *block = NULL;
-	FILE *file = NULL;
-
-	start = time(NULL);
-	file = fopen(filename, "w");
+	char *image = NULL;
+	char *manifest = NULL;
 
-	if (file == NULL)
+	if (parseFilename(cursor, &image) == -1)
 	{
-		ERROR(strerror(errno));
+		ERROR("Invalid image");
 		return -1;
 	}
 
-	if (!HighCapacity)
+	if (parseFilename(cursor, &manifest) == -1)
 	{
-		address *= BlockLength;
+		ERROR("Invalid manifest");
+		return -1;
 	}
 
-	signal(SIGINT, interrupt);
+	return syncImage(image, manifest);
+}
 
-	while (index < count)
+static int acceptTraceCommand(bool enable)
+{
+	if (enable && Trace.data == NULL)
 	{
-		if (command(17, address, Block, &response) == -1)
+		Trace.data = malloc(TRACE_CAPACITY);
+
+		if (Trace.data == NULL)
 		{
-			status = -1;
 			ERROR(strerror(errno));
-			break;
+			return -1;
 		}
+	}
 
-		block = &response.data.block;
-
-		if (block->r1 != Ready || block->token != BlockStart)
-		{
-			if (retries < RetryCount)
-			{
-				retries++;
-				continue;
-			}
+	if (!enable)
+	{
+		free(Trace.file);
+		Trace.file = NULL;
+	}
 
-			printBadBlockWarning(address);
-			retries = 0;
+	Trace.enabled = enable;
+	return 0;
+}
 
-			if (!FaultTolerant)
-			{
-				index--;
-				free(block->data);
-				break;
-			}
+static int acceptTraceSaveCommand(char **cursor)
+{
+	char *filename = NULL;
 
-			block->length = BlockLength;
-			block->data = calloc(1, block->length);
+	if (parseFilename(cursor, &filename) == -1)
+	{
+		ERROR("Invalid filename");
+		return -1;
+	}
 
-			if (block->data == NULL)
-			{
-				status = -1;
-				ERROR(strerror(errno));
-				break;
-			}
-		}
+	if (saveTrace(filename) == -1)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
 
-		if (fwrite(block->data, block->length, 1, file) < 1)
-		{
-			status = -1;
-			ERROR(strerror(errno));
-			free(block->data);
-			break;
-		}
+	return 0;
+}
 
-		free(block->data);
+static int acceptTraceAutoCommand(char **cursor)
+{
+	char *filename = NULL;
 
-		if (Interrupted)
+	if (parseFilename(cursor, &filename) == -1)
+	{
+		ERROR("Invalid filename");
+		return -1;
+	}
+
+	if (acceptTraceCommand(true) == -1)
+	{
+		return -1;
+	}
+
+	free(Trace.file);
+	Trace.file = strdup(filename);
+
+	if (Trace.file == NULL)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int acceptDecodeCommand(char **cursor)
+{
+	char *filename = NULL;
+
+	if (parseFilename(cursor, &filename) == -1)
+	{
+		ERROR("Invalid filename");
+		return -1;
+	}
+
+	if (decode(filename) == -1)
+	{
+		ERROR(strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int push(char *filename, uint32_t address)
+{
+	int status = 0;
+	size_t index = 0;
+	size_t count = 0;
+	uint32_t resent = 0;
+	uint32_t attempts = 0;
+	uint32_t run = 0;
+	uint32_t pending = 0;
+	uint32_t origin = 0;
+	uint32_t erased = 0;
+	uint64_t waited = 0;
+	bool bounded = false;
+	bool streaming = false;
+	struct Transfer transfer;
+	uint8_t *slot = NULL;
+	struct Block block = {0};
+	struct Ring ring;
+	struct stat information;
+	enum WriteStatus writeStatus = NotWritten;
+	FILE *file = NULL;
+
+	BusyTime = 0;
+	file = fopen(filename, "r");
+
+	if (file == NULL)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fileno(file), &information) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	bounded = S_ISREG(information.st_mode);
+
+	if (bounded && countBlocks(file, &count) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	if (openRing(&ring, file, readRing) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	beginTransfer(&transfer, count);
+
+	if (!HighCapacity)
+	{
+		address *= BlockLength;
+	}
+
+	signal(SIGINT, interrupt);
+
+	while (!bounded || index < count)
+	{
+		waited = now();
+		slot = drainSlot(&ring);
+		Statistics.fileWait += now() - waited;
+
+		if (slot == NULL)
+		{
+			break;
+		}
+
+		run = slotRun(&ring);
+
+		if (run > 0)
+		{
+			if (bounded && run > count - index)
+			{
+				run = count - index;
+			}
+
+			if (streaming)
+			{
+				streaming = false;
+
+				if (stopWrite() == -1)
+				{
+					status = -1;
+					FAILURE(strerror(errno));
+					break;
+				}
+			}
+
+			if (pending == 0)
+			{
+				origin = address;
+			}
+
+			pending += run;
+			transfer.holes += run;
+			releaseSlot(&ring);
+			address += blockAddress(run);
+			index += run;
+			continue;
+		}
+
+		if (pending > 0)
+		{
+			if (EraseHoles &&
+			    eraseHoles(origin, pending, &erased, &transfer) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			pending = 0;
+
+			if (transfer.bad > 0)
+			{
+				break;
+			}
+		}
+
+		block.data   = slot;
+		block.length = BlockLength;
+		writeStatus  = NotWritten;
+
+		if (attempts == 0)
+		{
+			beginBlock(&transfer);
+		}
+
+		if (!streaming)
+		{
+			if (startWrite(address, bounded && !Sparse ? count - index : 0,
+			               &streaming) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+		}
+
+		if (streaming)
+		{
+			block.token = BlockStartMultiple;
+			attempts++;
+
+			if (transmitBlock(&block) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			if (receiveWriteStatus(&writeStatus) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			if (writeStatus != WriteAccepted)
+			{
+				streaming = false;
+
+				if (stopWrite() == -1)
+				{
+					status = -1;
+					FAILURE(strerror(errno));
+					break;
+				}
+
+				if (writeStatus == WriteCRCError && resent < RetryCount)
+				{
+					resent++;
+					continue;
+				}
+			}
+		}
+
+		if (!streaming)
+		{
+			block.token = BlockStart;
+
+			if (storeBlock(address, &block, &writeStatus, &attempts,
+			               RetryCount + 1) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+		}
+
+		endBlock(&transfer, attempts);
+
+		if (writeStatus != WriteAccepted)
+		{
+			printBadBlockWarning(address);
+			transfer.bad++;
+			break;
+		}
+
+		releaseSlot(&ring);
+		resent = 0;
+		attempts = 0;
+
+		if (Interrupted)
+		{
+			Interrupted = false;
+			break;
+		}
+
+		nextBlock(&address);
+		index++;
+	}
+
+	if (streaming && stopWrite() == -1)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	if (status == 0 && transfer.bad == 0 && pending > 0 && EraseHoles &&
+	    eraseHoles(origin, pending, &erased, &transfer) == -1)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	if (closeRing(&ring) == -1 && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	else if (status == 0 && slot == NULL && bounded && index < count)
+	{
+		status = -1;
+		FAILURE("File truncated");
+	}
+
+	fclose(file);
+	signal(SIGINT, SIG_DFL);
+
+	if (transfer.holes > 0 && !EraseHoles)
+	{
+		fprintf(stderr, "Holes Skipped: %zu block(s) keep their old data\n",
+		        transfer.holes);
+	}
+
+	else if (erased > 0 && (!Card.scrValid || Card.scr.erasedOnes))
+	{
+		fprintf(stderr, "Holes Erased: %u block(s) %s as 0xff\n", erased,
+		        Card.scrValid ? "read back" : "may read back");
+	}
+
+	transfer.blocks = index - transfer.holes;
+	endTransfer(&transfer, "Pushed");
+	displayMicroseconds("Busy Time", BusyTime);
+	displayMicroseconds("Program Time", Card.busyEstimate);
+	putchar('\n');
+
+	return status;
+}
+
+static int pushChanges(char *filename, uint32_t block)
+{
+	int status = 0;
+	size_t index = 0;
+	size_t count = 0;
+	size_t changed = 0;
+	size_t runs = 0;
+	uint32_t size = 0;
+	uint32_t filled = 0;
+	uint32_t run = 0;
+	uint64_t waited = 0;
+	uint64_t readTime = 0;
+	uint64_t writeTime = 0;
+	bool bounded = false;
+	bool readable = true;
+	bool ended = false;
+	bool *dirty = NULL;
+	uint8_t *buffer = NULL;
+	uint8_t *image = NULL;
+	struct Transfer transfer;
+	struct Ring ring;
+	struct stat information;
+	FILE *file = NULL;
+
+	BusyTime = 0;
+	file = fopen(filename, "r");
+
+	if (file == NULL)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fileno(file), &information) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	bounded = S_ISREG(information.st_mode);
+
+	if (bounded && countBlocks(file, &count) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	errno = posix_memalign((void **)&buffer, BUFFER_ALIGNMENT,
+	                       (size_t)DIFF_BLOCKS * 2 * BlockLength);
+	dirty = errno ? NULL : calloc(DIFF_BLOCKS, sizeof(*dirty));
+	image = buffer + (size_t)DIFF_BLOCKS * BlockLength;
+
+	if (dirty == NULL)
+	{
+		ERROR(strerror(errno ? errno : ENOMEM));
+		free(buffer);
+		fclose(file);
+		return -1;
+	}
+
+	if (openRing(&ring, file, readRing) == -1)
+	{
+		FAILURE(strerror(errno));
+		free(dirty);
+		free(buffer);
+		fclose(file);
+		return -1;
+	}
+
+	beginTransfer(&transfer, count);
+	signal(SIGINT, interrupt);
+
+	while (!ended && (!bounded || index < count))
+	{
+		size = bounded && count - index < DIFF_BLOCKS ? count - index :
+		       DIFF_BLOCKS;
+
+		for (filled = 0; filled < size; filled++)
+		{
+			if (!copySlot(&ring, &run,
+			              image + (size_t)filled * BlockLength))
+			{
+				ended = true;
+				break;
+			}
+		}
+
+		if (filled == 0)
+		{
+			break;
+		}
+
+		waited = now();
+		readable = readBlocks(blockAddress(block + index), filled,
+		                      buffer) == 0;
+		readTime += now() - waited;
+
+		if (!readable && errno != EIO)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+
+		for (uint32_t offset = 0; offset < filled; offset++)
+		{
+			size_t position = (size_t)offset * BlockLength;
+
+			dirty[offset] = !readable ||
+			                memcmp(buffer + position, image + position,
+			                       BlockLength) != 0;
+		}
+
+		waited = now();
+
+		for (uint32_t first = 0, last = 0; first < filled; first = last)
+		{
+			last = first + 1;
+
+			while (last < filled && dirty[last] == dirty[first])
+			{
+				last++;
+			}
+
+			if (!dirty[first])
+			{
+				continue;
+			}
+
+			if (storeChanges(blockAddress(block + index + first), last - first,
+			                 image + (size_t)first * BlockLength,
+			                 &transfer) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			if (transfer.bad > 0)
+			{
+				break;
+			}
+
+			changed += last - first;
+			runs++;
+		}
+
+		writeTime += now() - waited;
+		index += filled;
+		transfer.blocks = index;
+
+		if (now() >= transfer.report)
+		{
+			reportProgress(&transfer);
+			transfer.report = now() + PROGRESS_INTERVAL;
+		}
+
+		if (status == -1 || transfer.bad > 0)
+		{
+			break;
+		}
+
+		if (Interrupted)
+		{
+			Interrupted = false;
+			break;
+		}
+	}
+
+	if (closeRing(&ring) == -1 && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	else if (status == 0 && transfer.bad == 0 && ended && bounded &&
+	         index < count)
+	{
+		status = -1;
+		FAILURE("File truncated");
+	}
+
+	free(dirty);
+	free(buffer);
+	fclose(file);
+	signal(SIGINT, SIG_DFL);
+
+	if (transfer.progressed)
+	{
+		fprintf(stderr, "\n");
+	}
+
+	waited = now() - transfer.start;
+
+	if (bounded)
+	{
+		printf("Compared %zu of %zu block(s) in %.3fs, %.2fMB/s\n", index,
+		       count, waited / 1e6,
+		       waited ? (double)index * BlockLength / waited : 0);
+	}
+
+	else
+	{
+		printf("Compared %zu block(s) in %.3fs, %.2fMB/s\n", index,
+		       waited / 1e6, waited ? (double)index * BlockLength / waited : 0);
+	}
+
+	displayCount("Changed Blocks", changed);
+	displayCount("Write Runs", runs);
+	displayMicroseconds("Read Time", readTime);
+	displayMicroseconds("Write Time", writeTime);
+	displayCount("Retries", transfer.retries);
+	displayCount("Bad Blocks", transfer.bad);
+	putchar('\n');
+
+	return status;
+}
+
+/*
+ * A rejected run counts as the first attempt at the block it stopped at, so
+ * that block is rewritten with cmd24, once plus the configured retries, and
+ * the rest of the run is streamed again after it.
+ */
+
+static int storeChanges(uint32_t address, uint32_t count, uint8_t *buffer,
+                        struct Transfer *transfer)
+{
+	struct Block block = { .length = BlockLength, .token = BlockStart };
+	enum WriteStatus writeStatus = NotWritten;
+	uint32_t attempts = 0;
+	uint32_t written = 0;
+
+	while (count > 0)
+	{
+		if (writeRun(address, count, buffer, &written) == 0)
+		{
+			return 0;
+		}
+
+		if (errno != EIO)
+		{
+			return -1;
+		}
+
+		address += blockAddress(written);
+		buffer  += (size_t)written * BlockLength;
+		count   -= written;
+
+		block.data = buffer;
+		attempts = 0;
+
+		if (storeBlock(address, &block, &writeStatus, &attempts,
+		               RetryCount + 1) == -1)
+		{
+			return -1;
+		}
+
+		transfer->retries += attempts;
+		Statistics.retries += attempts;
+
+		if (writeStatus != WriteAccepted)
+		{
+			printBadBlockWarning(address);
+			transfer->bad++;
+			return 0;
+		}
+
+		nextBlock(&address);
+		buffer += BlockLength;
+		count--;
+	}
+
+	return 0;
+}
+
+static int syncImage(char *imagename, char *manifestname)
+{
+	int status = 0;
+	size_t index = 0;
+	size_t count = 0;
+	size_t changed = 0;
+	size_t runs = 0;
+	size_t chunks = 0;
+	size_t entries = 0;
+	size_t updated = 0;
+	uint32_t capacity = 0;
+	uint32_t pending = 0;
+	uint32_t origin = 0;
+	uint32_t extent = 0;
+	uint32_t filled = 0;
+	uint32_t run = 0;
+	uint64_t hash = 0;
+	uint64_t previous = 0;
+	uint64_t waited = 0;
+	uint64_t writeTime = 0;
+	uint64_t *hashes = NULL;
+	uint64_t *updates = NULL;
+	uint64_t *grown = NULL;
+	bool bounded = false;
+	bool different = false;
+	bool done = false;
+	uint8_t *buffer = NULL;
+	struct ManifestHeader header;
+	struct Transfer transfer;
+	struct Ring ring;
+	struct stat information;
+	FILE *image = NULL;
+	FILE *manifest = NULL;
+
+	BusyTime = 0;
+	manifest = fopen(manifestname, "r+");
+
+	if (manifest == NULL)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (readManifest(manifest, &header) == -1)
+	{
+		ERROR("Invalid manifest");
+		fclose(manifest);
+		return -1;
+	}
+
+	image = fopen(imagename, "r");
+
+	if (image == NULL)
+	{
+		FAILURE(strerror(errno));
+		fclose(manifest);
+		return -1;
+	}
+
+	if (fstat(fileno(image), &information) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(image);
+		fclose(manifest);
+		return -1;
+	}
+
+	bounded = S_ISREG(information.st_mode);
+
+	if (bounded && countBlocks(image, &count) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(image);
+		fclose(manifest);
+		return -1;
+	}
+
+	entries  = ((size_t)header.count + header.chunk - 1) / header.chunk;
+	extent   = header.count;
+	capacity = header.chunk < DIFF_BLOCKS ?
+	           DIFF_BLOCKS / header.chunk * header.chunk : header.chunk;
+
+	errno = posix_memalign((void **)&buffer, BUFFER_ALIGNMENT,
+	                       (size_t)capacity * BlockLength);
+	hashes = errno ? NULL : calloc(capacity / header.chunk, sizeof(*hashes));
+
+	if (hashes == NULL)
+	{
+		ERROR(strerror(errno ? errno : ENOMEM));
+		free(buffer);
+		fclose(image);
+		fclose(manifest);
+		return -1;
+	}
+
+	if (openRing(&ring, image, readRing) == -1)
+	{
+		FAILURE(strerror(errno));
+		free(hashes);
+		free(buffer);
+		fclose(image);
+		fclose(manifest);
+		return -1;
+	}
+
+	beginTransfer(&transfer, count);
+	signal(SIGINT, interrupt);
+
+	while (!done)
+	{
+		uint8_t *chunk = buffer + (size_t)pending * BlockLength;
+
+		hash = HASH_SEED;
+
+		for (filled = 0; filled < header.chunk; filled++)
+		{
+			uint8_t *target = chunk + (size_t)filled * BlockLength;
+
+			if (!copySlot(&ring, &run, target))
+			{
+				break;
+			}
+
+			hash = hashBlock(target, BlockLength, hash);
+		}
+
+		done = filled < header.chunk || (bounded && index + filled >= count);
+		different = false;
+
+		if (filled > 0)
+		{
+			hash = finishHash(hash);
+			previous = ~hash;
+
+			if (chunks < entries && readHash(manifest, &previous) == -1)
+			{
+				status = -1;
+				ERROR("Invalid manifest");
+				break;
+			}
+
+			different = hash != previous || previous == HASH_UNKNOWN;
+
+			if (different)
+			{
+				origin = pending == 0 ? index : origin;
+				hashes[pending / header.chunk] = hash;
+				pending += filled;
+			}
+
+			index += filled;
+			chunks++;
+		}
+
+		if (pending > 0 &&
+		    (!different || done || pending + header.chunk > capacity))
+		{
+			waited = now();
+
+			if (storeChanges(blockAddress(header.block + origin), pending,
+			                 buffer, &transfer) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			writeTime += now() - waited;
+
+			if (transfer.bad > 0)
+			{
+				break;
+			}
+
+			grown = realloc(updates, (updated + capacity / header.chunk) *
+			                2 * sizeof(*updates));
+
+			if (grown == NULL)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			updates = grown;
+
+			for (uint32_t offset = 0; offset < pending; offset += header.chunk)
+			{
+				updates[updated * 2]     = (origin + offset) / header.chunk;
+				updates[updated * 2 + 1] = hashes[offset / header.chunk];
+				updated++;
+			}
+
+			if (origin + pending > extent)
+			{
+				extent = origin + pending;
+			}
+
+			changed += pending;
+			runs++;
+			pending = 0;
+		}
+
+		transfer.blocks = index;
+
+		if (now() >= transfer.report)
+		{
+			reportProgress(&transfer);
+			transfer.report = now() + PROGRESS_INTERVAL;
+		}
+
+		if (Interrupted)
+		{
+			Interrupted = false;
+			break;
+		}
+	}
+
+	if (closeRing(&ring) == -1 && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	if (status == 0 && transfer.bad == 0 && done)
+	{
+		extent = index;
+	}
+
+	for (size_t update = 0; update < updated; update++)
+	{
+		off_t offset = MANIFEST_HEADER_SIZE +
+		               updates[update * 2] * sizeof(hash);
+
+		if (fseeko(manifest, offset, SEEK_SET) == -1 ||
+		    writeHash(manifest, updates[update * 2 + 1]) == -1)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+	}
+
+	if (extent != header.count)
+	{
+		off_t length = MANIFEST_HEADER_SIZE + ((off_t)extent +
+		               header.chunk - 1) / header.chunk * sizeof(hash);
+
+		header.count = extent;
+
+		if (fseeko(manifest, 0, SEEK_SET) == -1 ||
+		    writeManifest(manifest, &header) == -1 ||
+		    fflush(manifest) == EOF ||
+		    ftruncate(fileno(manifest), length) == -1)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+		}
+	}
+
+	if (fclose(manifest) == EOF && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	free(updates);
+	free(hashes);
+	free(buffer);
+	fclose(image);
+	signal(SIGINT, SIG_DFL);
+
+	if (transfer.progressed)
+	{
+		fprintf(stderr, "\n");
+	}
+
+	waited = now() - transfer.start;
+	printf("Synced %zu block(s) in %.3fs, %.2fMB/s\n", index, waited / 1e6,
+	       waited ? (double)index * BlockLength / waited : 0);
+	displayCount("Changed Chunks", updated);
+	displayCount("Changed Blocks", changed);
+	displayCount("Write Runs", runs);
+	displayMicroseconds("Write Time", writeTime);
+	displayCount("Retries", transfer.retries);
+	displayCount("Bad Blocks", transfer.bad);
+	putchar('\n');
+
+	return status;
+}
+
+static int startWrite(uint32_t address, uint32_t count, bool *streaming)
+{
+	struct Response response;
+
+	*streaming = false;
+
+	if (PreErase && count > 0)
+	{
+		if (command(55, 0, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		if (command(23, count > 0x7fffff ? 0x7fffff : count, R1,
+		            &response) == -1)
+		{
+			return -1;
+		}
+	}
+
+	if (command(25, address, R1, &response) == -1)
+	{
+		return -1;
+	}
+
+	*streaming = response.data.r1 == Ready;
+	return 0;
+}
+
+static int stopWrite(void)
+{
+	uint8_t token = BlockStopMultiple;
+
+	if (transmitData(&token, sizeof(token), PollWindow) == -1)
+	{
+		return -1;
+	}
+
+	if (skipData(1) == -1)
+	{
+		return -1;
+	}
+
+	return awaitBusy(false);
+}
+
+static int erase(uint32_t block, uint32_t count)
+{
+	int status = 0;
+	uint32_t erased = 0;
+	uint32_t size = 0;
+	uint32_t timeout = 0;
+	uint64_t start = now();
+	uint64_t elapsed = 0;
+
+	BusyTime = 0;
+	EraseCommands = 0;
+	signal(SIGINT, interrupt);
+
+	if (eraseBlocks(blockAddress(block), count, &erased) == -1)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	signal(SIGINT, SIG_DFL);
+	Interrupted = false;
+	elapsed = now() - start;
+	planErase(&size, &timeout);
+
+	printf("Erased %u of %u block(s) in %.3fs, %.2fMB/s\n", erased, count,
+	       elapsed / 1e6,
+	       elapsed ? (double)erased * BlockLength / elapsed : 0);
+	displayCount("Erase Commands", EraseCommands);
+	displayBlocks("Erase Size", size);
+	displayMicroseconds("Erase Timeout", timeout);
+	displayMicroseconds("Busy Time", BusyTime);
+	putchar('\n');
+
+	return status;
+}
+
+static int eraseBlocks(uint32_t address, uint32_t count, uint32_t *erased)
+{
+	uint32_t first = HighCapacity ? address : address / BlockLength;
+	uint32_t last = first + count;
+	uint32_t limit = 0;
+	uint32_t timeout = 0;
+	uint32_t size = 0;
+
+	*erased = 0;
+	alignErase(&first, &last);
+	planErase(&limit, &timeout);
+
+	while (first < last && !Interrupted)
+	{
+		size = limit - first % limit;
+		size = last - first < size ? last - first : size;
+
+		if (eraseRange(blockAddress(first), size, timeout) == -1)
+		{
+			return -1;
+		}
+
+		EraseCommands++;
+		*erased += size;
+		first += size;
+	}
+
+	return 0;
+}
+
+/*
+ * Blocks of a hole run that fall outside whole erase sectors would keep
+ * their old data, so they are written as zero blocks instead.
+ */
+
+static int eraseHoles(uint32_t address, uint32_t count, uint32_t *erased,
+                      struct Transfer *transfer)
+{
+	uint32_t start = HighCapacity ? address : address / BlockLength;
+	uint32_t first = start;
+	uint32_t last = start + count;
+	uint32_t done = 0;
+
+	alignErase(&first, &last);
+
+	if (first >= last)
+	{
+		first = last = start + count;
+	}
+
+	if (writeZeros(start, first - start, transfer) == -1)
+	{
+		return -1;
+	}
+
+	if (transfer->bad > 0 || first == last)
+	{
+		return 0;
+	}
+
+	if (eraseBlocks(blockAddress(first), last - first, &done) == -1)
+	{
+		return -1;
+	}
+
+	*erased += done;
+	return writeZeros(last, start + count - last, transfer);
+}
+
+static int writeZeros(uint32_t block, uint32_t count, struct Transfer *transfer)
+{
+	uint32_t size = count < DIFF_BLOCKS ? count : DIFF_BLOCKS;
+	uint8_t *zeros = NULL;
+	int status = 0;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	zeros = calloc(size, BlockLength);
+
+	if (zeros == NULL)
+	{
+		return -1;
+	}
+
+	while (count > 0 && transfer->bad == 0)
+	{
+		size = count < size ? count : size;
+		status = storeChanges(blockAddress(block), size, zeros, transfer);
+
+		if (status == -1)
+		{
+			break;
+		}
+
+		block += size;
+		count -= size;
+	}
+
+	free(zeros);
+	return status;
+}
+
+static void alignErase(uint32_t *first, uint32_t *last)
+{
+	uint32_t sector = 0;
+
+	if (!Card.csdValid || Card.csd.version != CSD1 ||
+	    Card.csd.data.csd1.eraseBlockEnable)
+	{
+		return;
+	}
+
+	sector = ((Card.csd.data.csd1.eraseSectorSize + 1) <<
+	          Card.csd.data.csd1.writeBlockLength) / BlockLength;
+
+	if (sector == 0)
+	{
+		sector = 1;
+	}
+
+	*first = (*first + sector - 1) / sector * sector;
+	*last  = *last / sector * sector;
+}
+
+static int eraseRange(uint32_t address, uint32_t count, uint32_t timeout)
+{
+	struct Response response;
+	uint32_t limit = WriteTimeout;
+	int status = 0;
+
+	if (command(32, address, R1, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (response.data.r1 == Ready &&
+	    command(33, address + blockAddress(count - 1), R1, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (response.data.r1 != Ready)
+	{
+		errno = EIO;
+		return -1;
+	}
+
+	WriteTimeout = timeout;
+	status = command(38, 0, R1b, &response);
+	WriteTimeout = limit;
+
+	if (status == 0 && response.data.r1 != Ready)
+	{
+		errno = EIO;
+		return -1;
+	}
+
+	return status;
+}
+
+static void planErase(uint32_t *blocks, uint32_t *timeout)
+{
+	static const uint32_t units[] = {0, 16, 32, 64, 128, 256, 512, 1024,
+	                                 2048, 4096, 8192, 12288, 16384, 24576,
+	                                 32768, 65536};
+	struct SDStatus *status = &Card.status;
+	uint64_t size = 0;
+
+	*blocks  = ERASE_UNIT;
+	*timeout = WriteTimeout + ERASE_UNIT / ERASE_GRANULE * ERASE_TIMEOUT;
+
+	if (!Card.statusValid || status->allocationUnit == 0 ||
+	    status->eraseSize == 0 || status->eraseTimeout == 0)
+	{
+		return;
+	}
+
+	size = (uint64_t)status->eraseSize * units[status->allocationUnit] *
+	       1024 / BlockLength;
+
+	*blocks  = size < UINT32_MAX ? size : UINT32_MAX;
+	*timeout = (status->eraseTimeout + status->eraseOffset) * ERASE_SECOND;
+}
+
+static int storeBlock(uint32_t address, struct Block *block,
+                      enum WriteStatus *writeStatus, uint32_t *attempts,
+                      uint32_t limit)
+{
+	struct Response response;
+
+	for (uint32_t retries = 0; retries < limit; retries++)
+	{
+		*writeStatus = NotWritten;
+		(*attempts)++;
+
+		if (command(24, address, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		if (response.data.r1 != Ready)
+		{
+			continue;
+		}
+
+		if (transmitBlock(block) == -1)
+		{
+			return -1;
+		}
+
+		if (receiveWriteStatus(writeStatus) == -1)
+		{
+			return -1;
+		}
+
+		if (*writeStatus == WriteAccepted)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int pull(uint32_t address, uint32_t count, char *filename)
+{
+	int status = 0;
+	uint32_t index = 0;
+	uint32_t attempts = 0;
+	uint64_t waited = 0;
+	bool streaming = false;
+	struct Transfer transfer;
+	struct stat attributes;
+	uint8_t *slot = NULL;
+	struct Block block = {0};
+	struct Ring ring;
+	struct Manifest manifest = {0};
+	FILE *file = NULL;
+
+	file = fopen(filename, "w");
+
+	if (file == NULL)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (ManifestChunk > 0 &&
+	    openManifest(&manifest, filename, address, count) == -1)
+	{
+		FAILURE(strerror(errno));
+		fclose(file);
+		return -1;
+	}
+
+	if (openRing(&ring, file, writeRing) == -1)
+	{
+		FAILURE(strerror(errno));
+		closeManifest(&manifest);
+		fclose(file);
+		return -1;
+	}
+
+	beginTransfer(&transfer, count);
+
+	if (!HighCapacity)
+	{
+		address *= BlockLength;
+	}
+
+	signal(SIGINT, interrupt);
+
+	while (index < count)
+	{
+		waited = now();
+		slot = claimSlot(&ring);
+		Statistics.fileWait += now() - waited;
+
+		if (slot == NULL)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+
+		block.data = slot;
+		attempts = 0;
+		beginBlock(&transfer);
+
+		if (!streaming)
+		{
+			if (startTransmission(address, &block) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			streaming = block.r1 == Ready;
+		}
+
+		if (streaming)
+		{
+			attempts++;
+
+			if (receiveStreamBlock(BlockLength, &block) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+
+			if (!block.valid)
+			{
+				streaming = false;
+
+				if (stopTransmission() == -1)
+				{
+					status = -1;
+					FAILURE(strerror(errno));
+					break;
+				}
+			}
+		}
+
+		if (!streaming)
+		{
+			if (retrieveBlock(address, &block, &attempts) == -1)
+			{
+				status = -1;
+				FAILURE(strerror(errno));
+				break;
+			}
+		}
+
+		endBlock(&transfer, attempts);
+
+		if (block.r1 != Ready || !block.valid)
+		{
+			printBadBlockWarning(address);
+			transfer.bad++;
+
+			if (!FaultTolerant)
+			{
+				break;
+			}
+
+			memset(slot, 0, BlockLength);
+		}
+
+		if (manifest.file != NULL)
+		{
+			addManifest(&manifest, slot,
+			            block.r1 == Ready && block.valid);
+		}
+
+		fillSlot(&ring);
+
+		if (Interrupted)
+		{
+			Interrupted = false;
+			break;
+		}
+
+		nextBlock(&address);
+		index++;
+	}
+
+	if (streaming && stopTransmission() == -1)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	if (closeRing(&ring) == -1 && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	if (closeManifest(&manifest) == -1 && status == 0)
+	{
+		status = -1;
+		FAILURE(strerror(errno));
+	}
+
+	fclose(file);
+	signal(SIGINT, SIG_DFL);
+
+	transfer.blocks = ring.transferred;
+	endTransfer(&transfer, "Pulled");
+
+	if (Sparse && stat(filename, &attributes) == 0 &&
+	    S_ISREG(attributes.st_mode))
+	{
+		displayBytes("Logical Size", attributes.st_size);
+		displayBytes("Allocated Size", (uint64_t)attributes.st_blocks * 512);
+	}
+
+	putchar('\n');
+
+	return status;
+}
+
+static int startTransmission(uint32_t address, struct Block *block)
+{
+	struct Response response;
+
+	if (command(18, address, Stream, &response) == -1)
+	{
+		return -1;
+	}
+
+	block->r1    = response.data.r1;
+	block->token = 0;
+	return 0;
+}
+
+static int stopTransmission(void)
+{
+	struct Response response;
+
+	if (transmitCommand(12, 0, measureResponse(R1b) + 1) == -1)
+	{
+		return -1;
+	}
+
+	if (skipData(1) == -1)
+	{
+		return -1;
+	}
+
+	return receiveResponse(R1b, &response);
+}
+
+static int retrieveBlock(uint32_t address, struct Block *block,
+                         uint32_t *attempts)
+{
+	for (uint32_t retries = 0; retries <= RetryCount; retries++)
+	{
+		(*attempts)++;
+
+		if (transmitCommand(17, address, measureResponse(Block)) == -1)
+		{
+			return -1;
+		}
+
+		if (receiveBlock(BlockLength, block) == -1)
+		{
+			return -1;
+		}
+
+		if (block->valid)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int identify(void)
+{
+	struct Response response;
+	uint64_t start = now();
+	uint64_t phase = start;
+	uint32_t condition = 0;
+	enum R1 r1 = Idle;
+	char *type = NULL;
+	bool application = true;
+
+	slowClock();
+	memset(&Card, 0, sizeof(Card));
+	deriveTimeouts();
+	HighCapacity = false;
+
+	for (int attempt = 0; attempt < 3; attempt++)
+	{
+		if (command(0, 0, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		if (response.data.r1 == Idle)
+		{
+			break;
+		}
+	}
+
+	if (response.data.r1 != Idle)
+	{
+		errno = ENODEV;
+		return -1;
+	}
+
+	displayMicroseconds("Reset", now() - phase);
+	phase = now();
+
+	if (command(8, INIT_CONDITION, R7, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (response.data.r7.r1 == Idle)
+	{
+		if (response.data.r7.voltage != (INIT_CONDITION >> 8) ||
+		    response.data.r7.pattern != (INIT_CONDITION & 0xff))
+		{
+			errno = ENODEV;
+			return -1;
+		}
+
+		condition = OCR_CCS;
+	}
+
+	displayMicroseconds("Interface Condition", now() - phase);
+	phase = now();
+
+	if (awaitReady(41, condition, &r1) == -1)
+	{
+		return -1;
+	}
+
+	if (r1 & IllegalCommand)
+	{
+		type = "MMC";
+		application = false;
+
+		if (awaitReady(1, 0, &r1) == -1)
+		{
+			return -1;
+		}
+	}
+
+	if (r1 != Ready)
+	{
+		errno = r1 == Idle ? ETIMEDOUT : ENODEV;
+		return -1;
+	}
+
+	rampClock();
+	displayMicroseconds("Initialisation", now() - phase);
+	phase = now();
+
+	if (command(58, 0, R3, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (type == NULL)
+	{
+		type = HighCapacity ? "SDHC/SDXC" : condition ? "SDSC v2" : "SDSC v1";
+	}
+
+	displayMicroseconds("Operating Condition", now() - phase);
+	phase = now();
+
+	if (command(9, 0, CSD, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (!Card.csdValid)
+	{
+		errno = EIO;
+		return -1;
+	}
+
+	if (command(10, 0, CID, &response) == -1)
+	{
+		return -1;
+	}
+
+	if (!Card.cidValid)
+	{
+		errno = EIO;
+		return -1;
+	}
+
+	if (application && command(55, 0, R1, &response) == 0 &&
+	    response.data.r1 == Ready)
+	{
+		command(13, 0, SDStatus, &response);
+	}
+
+	if (application && command(55, 0, R1, &response) == 0 &&
+	    response.data.r1 == Ready)
+	{
+		command(51, 0, SCR, &response);
+	}
+
+	displayMicroseconds("Registers", now() - phase);
+	phase = now();
+
+	if (!HighCapacity)
+	{
+		if (command(16, 512, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		if (response.data.r1 != Ready)
+		{
+			errno = EIO;
+			return -1;
+		}
+
+		displayMicroseconds("Block Length", now() - phase);
+	}
+
+	BlockLength = 512;
+	displayMicroseconds("Total", now() - start);
+	displayString("Card Type", type);
+	displayFrequency("Bus Frequency", BusFrequency);
+	putchar('\n');
+
+	return 0;
+}
+
+static int awaitReady(uint8_t commandType, uint32_t data, enum R1 *r1)
+{
+	struct Response response;
+	uint64_t deadline = now() + INIT_DEADLINE;
+	uint32_t interval = INIT_INTERVAL_MIN;
+
+	while (true)
+	{
+		if (commandType == 41 && command(55, 0, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		if (command(commandType, data, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		*r1 = response.data.r1;
+
+		if (*r1 != Idle || now() >= deadline)
+		{
+			return 0;
+		}
+
+		usleep(interval);
+
+		if (interval < INIT_INTERVAL_MAX)
+		{
+			interval *= 2;
+		}
+	}
+}
+
+static uint64_t now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static int tune(uint32_t address, uint32_t count, uint32_t ceiling, bool apply)
+{
+	static const uint32_t frequencies[] =
+	{
+		400000, 1000000, 2000000, 4000000, 8000000, 12500000,
+		16000000, 20000000, 25000000, 32000000, 40000000, 50000000
+	};
+
+	int status = 0;
+	uint32_t best = 0;
+	bool reliable = true;
+	char label[16];
+	uint8_t *streamed = NULL;
+	uint8_t *single = NULL;
+	size_t length = (size_t)count * BlockLength;
+	bool adaptive = AdaptiveClock;
+	bool checked = CheckCRC;
+	uint32_t bus = BusFrequency;
+	uint32_t clock = ClockFrequency;
+	uint8_t verbosity = Verbosity;
+
+	streamed = malloc(length);
+	single = malloc(length);
+
+	if (streamed == NULL || single == NULL)
+	{
+		FAILURE(strerror(errno));
+		free(streamed);
+		free(single);
+		return -1;
+	}
+
+	if (!HighCapacity)
+	{
+		address *= BlockLength;
+	}
+
+	AdaptiveClock = false;
+	CheckCRC = true;
+	Verbosity = Quiet;
+
+	for (size_t step = 0; step < sizeof(frequencies) / sizeof(*frequencies); step++)
+	{
+		uint64_t start, end;
+		uint32_t errors = 0;
+		double rate = 0;
+		double errorRate = 0;
+
+		if (ceiling > 0 && frequencies[step] > ceiling)
+		{
+			break;
+		}
+
+		ClockFrequency = frequencies[step];
+		BusFrequency = frequencies[step];
+
+		if (setClockFrequency() == -1)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+
+		start = now();
+
+		if (sampleBlocks(address, count, streamed, true, &errors) == -1)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+
+		end = now();
+
+		if (sampleBlocks(address, count, single, false, &errors) == -1)
+		{
+			status = -1;
+			FAILURE(strerror(errno));
+			break;
+		}
+
+		for (uint32_t index = 0; index < count; index++)
+		{
+			size_t offset = (size_t)index * BlockLength;
+
+			if (memcmp(streamed + offset, single + offset, BlockLength) != 0)
+			{
+				errors++;
+			}
+		}
+
+		rate = end > start ? (double)length / (end - start) : 0;
+		errorRate = errors < 2 * (uint64_t)count ?
+		            errors / (2.0 * count) : 1;
+
+		snprintf(label, sizeof(label), "%uHz", BusFrequency);
+		printf("  %-32s%.2fMB/s, %u error(s), %.2f%% error rate\n",
+		       label, rate, errors, errorRate * 100);
+
+		if (errors > 0)
+		{
+			reliable = false;
+		}
+
+		else if (reliable)
+		{
+			best = BusFrequency;
+		}
+
+		if (Interrupted)
+		{
+			Interrupted = false;
+			break;
+		}
+	}
+
+	AdaptiveClock = adaptive;
+	CheckCRC = checked;
+	Verbosity = verbosity;
+	BusFrequency = bus;
+	ClockFrequency = clock;
+
+	free(streamed);
+	free(single);
+
+	if (setClockFrequency() == -1)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	if (best == 0)
+	{
+		printf("No reliable frequency\n\n");
+		return status;
+	}
+
+	printf("Fastest reliable frequency %uHz\n\n", best);
+
+	if (apply)
+	{
+		ClockFrequency = best;
+		BusFrequency = best;
+
+		if (setClockFrequency() == -1)
+		{
+			FAILURE(strerror(errno));
+			return -1;
+		}
+	}
+
+	return status;
+}
+
+static int sampleBlocks(uint32_t address, uint32_t count, uint8_t *buffer,
+                        bool streaming, uint32_t *errors)
+{
+	int status = 0;
+	bool started = false;
+	struct Block block = {0};
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		block.data  = buffer + (size_t)index * BlockLength;
+		block.r1    = Ready;
+		block.valid = false;
+
+		if (streaming && !started)
+		{
+			if (startTransmission(address, &block) == -1)
+			{
+				status = -1;
+				break;
+			}
+
+			started = block.r1 == Ready;
+		}
+
+		if (started)
+		{
+			if (receiveStreamBlock(BlockLength, &block) == -1)
+			{
+				status = -1;
+				break;
+			}
+		}
+
+		else
+		{
+			if (transmitCommand(17, address, measureResponse(Block)) == -1)
+			{
+				status = -1;
+				break;
+			}
+
+			if (receiveBlock(BlockLength, &block) == -1 &&
+			    block.r1 == Ready)
+			{
+				status = -1;
+				break;
+			}
+		}
+
+		if (block.r1 != Ready || !block.valid)
+		{
+			memset(block.data, 0, BlockLength);
+			(*errors)++;
+
+			if (started)
+			{
+				started = false;
+
+				if (stopTransmission() == -1)
+				{
+					return -1;
+				}
+			}
+		}
+
+		nextBlock(&address);
+	}
+
+	if (started && stopTransmission() == -1)
+	{
+		return -1;
+	}
+
+	return status;
+}
+
+static int bench(uint32_t address, uint32_t count, bool writable)
+{
+	static const uint32_t sizes[] = {1, 8, 64, BENCH_SIZE_LIMIT};
+
+	int status = 0;
+	uint8_t *buffer = NULL;
+	uint8_t verbosity = Verbosity;
+
+	errno = posix_memalign((void **)&buffer, BUFFER_ALIGNMENT,
+	                       (size_t)BENCH_SIZE_LIMIT * BlockLength);
+
+	if (errno)
+	{
+		FAILURE(strerror(errno));
+		return -1;
+	}
+
+	for (size_t index = 0; index < (size_t)BENCH_SIZE_LIMIT * BlockLength; index++)
+	{
+		buffer[index] = index * 7;
+	}
+
+	Verbosity = Quiet;
+	srand(address ^ count);
+	signal(SIGINT, interrupt);
+
+	printf("test,bytes,operations,seconds,mbps,iops,"
+	       "min_us,avg_us,p50_us,p99_us,max_us\n");
+
+	for (size_t step = 0; step < sizeof(sizes) / sizeof(*sizes); step++)
+	{
+		if (sizes[step] > count || status == -1 || Interrupted)
+		{
+			break;
+		}
+
+		status = benchSequential("sequential-read", address, count,
+		                         sizes[step], false, buffer);
+
+		if (status == 0 && writable)
+		{
+			status = benchSequential("sequential-write", address, count,
+			                         sizes[step], true, buffer);
+		}
+	}
+
+	for (uint32_t size = 1; size <= 8 && size <= count; size *= 8)
+	{
+		if (status == -1 || Interrupted)
+		{
+			break;
+		}
+
+		status = benchRandom("random-read", address, count, size, false,
+		                     buffer);
+
+		if (status == 0 && writable)
+		{
+			status = benchRandom("random-write", address, count, size, true,
+			                     buffer);
+		}
+	}
+
+	if (status == 0 && !Interrupted)
+	{
+		status = benchCommand(17, address, buffer);
+	}
+
+	if (status == 0 && !Interrupted && writable)
+	{
+		status = benchCommand(24, address, buffer);
+	}
+
+	if (status == 0 && !Interrupted)
+	{
+		status = benchCommand(13, address, buffer);
+	}
+
+	if (status == -1)
+	{
+		FAILURE(strerror(errno));
+	}
+
+	putchar('\n');
+	signal(SIGINT, SIG_DFL);
+	Interrupted = false;
+	Verbosity = verbosity;
+	free(buffer);
+	return status;
+}
+
+static int benchSequential(char *name, uint32_t address, uint32_t count,
+                           uint32_t size, bool writing, uint8_t *buffer)
+{
+	struct Transfer transfer;
+
+	beginTransfer(&transfer, count / size);
+	transfer.report = UINT64_MAX;
+
+	for (uint32_t offset = 0; offset + size <= count; offset += size)
+	{
+		int status = 0;
+
+		beginBlock(&transfer);
+
+		if (writing)
+		{
+			status = writeBlocks(blockAddress(address + offset), size, buffer);
+		}
+
+		else
+		{
+			status = readBlocks(blockAddress(address + offset), size, buffer);
+		}
+
+		if (status == -1)
+		{
+			return -1;
+		}
+
+		endBlock(&transfer, 1);
+
+		if (Interrupted)
+		{
+			break;
+		}
+	}
+
+	reportBench(name, (size_t)size * BlockLength, &transfer);
+	return 0;
+}
+
+static int benchRandom(char *name, uint32_t address, uint32_t count,
+                       uint32_t size, bool writing, uint8_t *buffer)
+{
+	struct Transfer transfer;
+	uint32_t slots = count / size;
+
+	beginTransfer(&transfer, BENCH_OPERATIONS);
+	transfer.report = UINT64_MAX;
+
+	for (uint32_t operation = 0; operation < BENCH_OPERATIONS; operation++)
+	{
+		uint32_t slot = (((uint32_t)rand() << 16) ^ rand()) % slots;
+		uint32_t target = blockAddress(address + slot * size);
+		int status = 0;
+
+		beginBlock(&transfer);
+
+		if (writing)
+		{
+			status = writeBlocks(target, size, buffer);
+		}
+
+		else
+		{
+			status = readBlocks(target, size, buffer);
+		}
+
+		if (status == -1)
+		{
+			return -1;
+		}
+
+		endBlock(&transfer, 1);
+
+		if (Interrupted)
+		{
+			break;
+		}
+	}
+
+	reportBench(name, (size_t)size * BlockLength, &transfer);
+	return 0;
+}
+
+static int benchCommand(uint8_t type, uint32_t address, uint8_t *buffer)
+{
+	struct Response response;
+	struct Transfer transfer;
+	char name[8];
+
+	snprintf(name, sizeof(name), "cmd%d", type);
+	beginTransfer(&transfer, BENCH_SAMPLES);
+	transfer.report = UINT64_MAX;
+
+	for (uint32_t sample = 0; sample < BENCH_SAMPLES; sample++)
+	{
+		int status = 0;
+
+		beginBlock(&transfer);
+
+		if (type == 13)
+		{
+			status = command(13, 0, R2, &response);
+		}
+
+		else if (type == 24)
+		{
+			status = writeBlocks(blockAddress(address), 1, buffer);
+		}
+
+		else
+		{
+			status = readBlocks(blockAddress(address), 1, buffer);
+		}
+
+		if (status == -1)
+		{
+			return -1;
+		}
+
+		endBlock(&transfer, 1);
+
+		if (Interrupted)
+		{
+			break;
+		}
+	}
+
+	reportBench(name, type == 13 ? 0 : BlockLength, &transfer);
+	return 0;
+}
+
+static int readBlocks(uint32_t address, uint32_t count, uint8_t *buffer)
+{
+	struct Block block = {0};
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		block.data = buffer + (size_t)index * BlockLength;
+
+		if (count == 1)
+		{
+			if (transmitCommand(17, address, measureResponse(Block)) == -1)
+			{
+				return -1;
+			}
+
+			if (receiveBlock(BlockLength, &block) == -1)
+			{
+				return -1;
+			}
+		}
+
+		else
+		{
+			if (index == 0)
+			{
+				if (startTransmission(address, &block) == -1)
+				{
+					return -1;
+				}
+
+				if (block.r1 != Ready)
+				{
+					errno = EIO;
+					return -1;
+				}
+			}
+
+			if (receiveStreamBlock(BlockLength, &block) == -1)
+			{
+				return -1;
+			}
+		}
+
+		if (block.r1 != Ready || !block.valid)
+		{
+			if (count > 1 && stopTransmission() == -1)
+			{
+				return failStop();
+			}
+
+			errno = EIO;
+			return -1;
+		}
+	}
+
+	if (count > 1 && stopTransmission() == -1)
+	{
+		return failStop();
+	}
+
+	return 0;
+}
+
+static int writeBlocks(uint32_t address, uint32_t count, uint8_t *buffer)
+{
+	uint32_t written = 0;
+
+	return writeRun(address, count, buffer, &written);
+}
+
+static int writeRun(uint32_t address, uint32_t count, uint8_t *buffer,
+                    uint32_t *written)
+{
+	struct Response response;
+	struct Block block = { .length = BlockLength };
+	enum WriteStatus writeStatus = NotWritten;
+	bool streaming = false;
+
+	*written = 0;
+
+	if (count == 1)
+	{
+		if (command(24, address, R1, &response) == -1)
+		{
+			return -1;
+		}
+
+		streaming = response.data.r1 == Ready;
+		block.token = BlockStart;
+	}
+
+	else
+	{
+		if (startWrite(address, count, &streaming) == -1)
+		{
+			return -1;
+		}
+
+		block.token = BlockStartMultiple;
+	}
+
+	if (!streaming)
+	{
+		errno = EIO;
+		return -1;
+	}
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		block.data = buffer + (size_t)index * BlockLength;
+
+		if (transmitBlock(&block) == -1)
+		{
+			return -1;
+		}
+
+		if (receiveWriteStatus(&writeStatus) == -1)
+		{
+			return -1;
+		}
+
+		if (writeStatus != WriteAccepted)
+		{
+			if (count > 1 && stopWrite() == -1)
+			{
+				return failStop();
+			}
+
+			errno = EIO;
+			return -1;
+		}
+
+		(*written)++;
+	}
+
+	if (count > 1 && stopWrite() == -1)
+	{
+		return failStop();
+	}
+
+	return 0;
+}
+
+/*
+ * Callers of readBlocks and writeRun recover from EIO, which means a
+ * rejected block, so a failed stop is reported as EPROTO: the card may still
+ * be streaming and must not be sent another command.
+ */
+
+static int failStop(void)
+{
+	if (errno == EIO)
+	{
+		errno = EPROTO;
+	}
+
+	return -1;
+}
+
+static uint32_t blockAddress(uint32_t block)
+{
+	return HighCapacity ? block : block * BlockLength;
+}
+
+static void reportBench(char *name, size_t bytes, struct Transfer *transfer)
+{
+	uint64_t elapsed = now() - transfer->start;
+	double seconds = elapsed / 1e6;
+	size_t operations = transfer->blocks;
+
+	if (operations == 0 || elapsed == 0)
+	{
+		return;
+	}
+
+	printf("%s,%zu,%zu,%.6f,%.3f,%.1f,"
+	       "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+	       name, bytes, operations, seconds,
+	       (double)bytes * operations / elapsed, operations / seconds,
+	       transfer->minimum, transfer->total / operations,
+	       measureLatency(transfer, 0.5), measureLatency(transfer, 0.99),
+	       transfer->maximum);
+}
+
+static void nextBlock(uint32_t *address)
+{
+	if (HighCapacity)
+	{
+		(*address)++;
+	}
+
+	else
+	{
+		*address += BlockLength; 
+	}
+}
+
+static int countBlocks(FILE *file, size_t *count)
+{
+	long offset = 0;
+
+	if (fseek(file, 0, SEEK_END) == -1)
+	{
+		return -1;
+	}
+
+	offset = ftell(file);
+
+	if (offset == -1)
+	{
+		return -1;
+	}
+
+	if (fseek(file, 0, SEEK_SET) == -1)
+	{
+		return -1;
+	}
+
+	*count = offset / BlockLength;
+	
+	if (offset % BlockLength)
+	{
+		(*count)++;
+	}
+
+	return 0;
+}
+
+static void printBadBlockWarning(uint32_t address)
+{
+	if (!HighCapacity)
+	{
+		address /= BlockLength;
+	}
+
+	fprintf(stderr, "Bad Block: %d\n", address);
+	flushTrace();
+}
+
+static void beginTransfer(struct Transfer *transfer, size_t count)
+{
+	memset(transfer, 0, sizeof(*transfer));
+	transfer->count   = count;
+	transfer->minimum = UINT64_MAX;
+	transfer->start   = now();
+	transfer->report  = transfer->start + PROGRESS_INTERVAL;
+}
+
+static void beginBlock(struct Transfer *transfer)
+{
+	transfer->begun = now();
+}
+
+static void endBlock(struct Transfer *transfer, uint32_t attempts)
+{
+	uint64_t end = now();
+	uint64_t latency = end - transfer->begun;
+
+	transfer->blocks++;
+	transfer->timed++;
+	transfer->total += latency;
+	transfer->histogram[bucketLatency(latency)]++;
+
+	if (latency < transfer->minimum)
+	{
+		transfer->minimum = latency;
+	}
+
+	if (latency > transfer->maximum)
+	{
+		transfer->maximum = latency;
+	}
+
+	if (attempts > 1)
+	{
+		transfer->retries += attempts - 1;
+		Statistics.retries += attempts - 1;
+	}
+
+	if (end >= transfer->report)
+	{
+		reportProgress(transfer);
+		transfer->report = end + PROGRESS_INTERVAL;
+	}
+}
+
+static void reportProgress(struct Transfer *transfer)
+{
+	uint64_t elapsed = now() - transfer->start;
+	size_t blocks = transfer->blocks + transfer->holes;
+	double rate = (double)blocks * BlockLength / elapsed;
+	char terminator = isatty(STDERR_FILENO) ? '\r' : '\n';
+
+	if (Verbosity >= Responses || elapsed == 0)
+	{
+		return;
+	}
+
+	if (transfer->count > blocks && rate > 0)
+	{
+		double remaining = (transfer->count - blocks) *
+		                   (double)BlockLength / rate / 1e6;
+
+		fprintf(stderr, "%zu of %zu block(s), %.2fMB/s, %.0fs left%c",
+		        blocks, transfer->count, rate, remaining, terminator);
+	}
+
+	else
+	{
+		fprintf(stderr, "%zu block(s), %.2fMB/s%c", blocks, rate,
+		        terminator);
+	}
+
+	transfer->progressed = terminator == '\r';
+}
+
+static void endTransfer(struct Transfer *transfer, char *verb)
+{
+	uint64_t elapsed = now() - transfer->start;
+	size_t blocks = transfer->blocks + transfer->holes;
+	double rate = elapsed ? (double)blocks * BlockLength / elapsed : 0;
+
+	if (transfer->progressed)
+	{
+		fprintf(stderr, "\n");
+	}
+
+	if (transfer->count > 0)
+	{
+		printf("%s %zu of %zu block(s) in %.3fs, %.2fMB/s\n", verb,
+		       blocks, transfer->count, elapsed / 1e6, rate);
+	}
+
+	else
+	{
+		printf("%s %zu block(s) in %.3fs, %.2fMB/s\n", verb,
+		       blocks, elapsed / 1e6, rate);
+	}
+
+	if (transfer->timed > 0)
+	{
+		displayMicroseconds("Minimum Latency", transfer->minimum);
+		displayMicroseconds("Average Latency",
+		                    transfer->total / transfer->timed);
+		displayMicroseconds("Median Latency", measureLatency(transfer, 0.5));
+		displayMicroseconds("99th Percentile Latency",
+		                    measureLatency(transfer, 0.99));
+		displayMicroseconds("Maximum Latency", transfer->maximum);
+	}
+
+	displayCount("Retries", transfer->retries);
+	displayCount("Bad Blocks", transfer->bad);
+
+	if (transfer->holes > 0)
+	{
+		displayCount("Holes", transfer->holes);
+	}
+}
+
+static size_t bucketLatency(uint64_t latency)
+{
+	int order = 0;
+
+	if (latency < 16)
+	{
+		return latency;
+	}
+
+	if (latency > UINT32_MAX)
+	{
+		latency = UINT32_MAX;
+	}
+
+	while ((latency >> order) > 1)
+	{
+		order++;
+	}
+
+	return 16 + (order - 4) * 8 + ((latency >> (order - 3)) & 0x07);
+}
+
+static uint64_t measureLatency(struct Transfer *transfer, double fraction)
+{
+	uint64_t target = fraction * transfer->timed;
+	uint64_t seen = 0;
+
+	for (size_t index = 0; index < LATENCY_BUCKETS; index++)
+	{
+		seen += transfer->histogram[index];
+
+		if (seen > target || seen == transfer->timed)
+		{
+			uint64_t latency = index;
+
+			if (index >= 16)
+			{
+				int order = 4 + (index - 16) / 8;
+
+				latency = ((8 + (index - 16) % 8) << (order - 3)) +
+				          ((uint64_t)1 << (order - 3)) / 2;
+			}
+
+			return latency < transfer->maximum ? latency : transfer->maximum;
+		}
+	}
+
+	return transfer->maximum;
+}
+
+static int openRing(struct Ring *ring, FILE *file, void *(*worker)(void *))
+{
+	struct stat information;
+
+	memset(ring, 0, sizeof(*ring));
+
+	if (fstat(fileno(file), &information) == -1)
+	{
+		return -1;
+	}
+
+	ring->depth  = RingDepth;
+	ring->length = BlockLength;
+	ring->stride = (BlockLength + BUFFER_ALIGNMENT - 1) &
+	               ~(BUFFER_ALIGNMENT - 1);
+	ring->file   = file;
+	ring->stream = !S_ISREG(information.st_mode);
+	ring->sparse = Sparse && (worker == readRing || !ring->stream);
+	ring->extents = true;
+	ring->wake[0] = -1;
+	ring->wake[1] = -1;
+
+	if (ring->stream && worker == readRing &&
+	    pipe2(ring->wake, O_CLOEXEC | O_NONBLOCK) == -1)
+	{
+		return -1;
+	}
+
+	errno = posix_memalign((void **)&ring->buffer, BUFFER_ALIGNMENT,
+	                       ring->depth * ring->stride);
+
+	if (errno)
+	{
+		closeWake(ring);
+		return -1;
+	}
+
+	ring->runs = calloc(ring->depth, sizeof(*ring->runs));
+
+	if (ring->runs == NULL)
+	{
+		free(ring->buffer);
+		closeWake(ring);
+		return -1;
+	}
+
+	pthread_mutex_init(&ring->mutex, NULL);
+	pthread_cond_init(&ring->changed, NULL);
+
+	errno = pthread_create(&ring->thread, NULL, worker, ring);
+
+	if (errno)
+	{
+		pthread_cond_destroy(&ring->changed);
+		pthread_mutex_destroy(&ring->mutex);
+		free(ring->runs);
+		free(ring->buffer);
+		closeWake(ring);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int closeRing(struct Ring *ring)
+{
+	sealRing(ring);
+
+	pthread_join(ring->thread, NULL);
+	Statistics.fileTime += ring->fileTime;
+	pthread_cond_destroy(&ring->changed);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring->runs);
+	free(ring->buffer);
+	closeWake(ring);
+
+	if (ring->error)
+	{
+		errno = ring->error;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void sealRing(struct Ring *ring)
+{
+	uint8_t token = 0;
+
+	pthread_mutex_lock(&ring->mutex);
+	ring->closed = true;
+	pthread_cond_broadcast(&ring->changed);
+	pthread_mutex_unlock(&ring->mutex);
+
+	if (ring->wake[1] != -1 && write(ring->wake[1], &token, 1) == -1 &&
+	    errno != EAGAIN)
+	{
+		abandonRing(ring, errno);
+	}
+}
+
+static void closeWake(struct Ring *ring)
+{
+	if (ring->wake[0] != -1)
+	{
+		close(ring->wake[0]);
+		close(ring->wake[1]);
+	}
+}
+
+static void abandonRing(struct Ring *ring, int error)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->error = error;
+	pthread_cond_broadcast(&ring->changed);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+static uint8_t *claimSlot(struct Ring *ring)
+{
+	uint8_t *slot = NULL;
+
+	pthread_mutex_lock(&ring->mutex);
+
+	while (ring->count == ring->depth && !ring->closed && !ring->error)
+	{
+		pthread_cond_wait(&ring->changed, &ring->mutex);
+	}
+
+	if (ring->error)
+	{
+		errno = ring->error;
+	}
+
+	else if (!ring->closed)
+	{
+		slot = ring->buffer + ring->head * ring->stride;
+	}
+
+	pthread_mutex_unlock(&ring->mutex);
+	return slot;
+}
+
+static void fillSlot(struct Ring *ring)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->head = (ring->head + 1) % ring->depth;
+	ring->count++;
+	pthread_cond_broadcast(&ring->changed);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+static uint8_t *drainSlot(struct Ring *ring)
+{
+	uint8_t *slot = NULL;
+
+	pthread_mutex_lock(&ring->mutex);
+
+	while (ring->count == 0 && !ring->closed && !ring->error)
+	{
+		pthread_cond_wait(&ring->changed, &ring->mutex);
+	}
+
+	if (ring->count > 0 && !ring->error)
+	{
+		slot = ring->buffer + ring->tail * ring->stride;
+	}
+
+	pthread_mutex_unlock(&ring->mutex);
+	return slot;
+}
+
+static void releaseSlot(struct Ring *ring)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->tail = (ring->tail + 1) % ring->depth;
+	ring->count--;
+	ring->transferred++;
+	pthread_cond_broadcast(&ring->changed);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+static void *writeRing(void *argument)
+{
+	struct Ring *ring = argument;
+	uint8_t *slot = NULL;
+	uint64_t start = 0;
+	size_t written = 0;
+
+	while ((slot = drainSlot(ring)) != NULL)
+	{
+		start = now();
+
+		if (skipSlot(ring, slot) == 0)
+		{
+			written = 1;
+		}
+
+		else
+		{
+			written = fwrite(slot, ring->length, 1, ring->file);
+		}
+
+		ring->fileTime += now() - start;
+
+		if (written < 1)
+		{
+			abandonRing(ring, errno ? errno : EIO);
+			break;
+		}
+
+		releaseSlot(ring);
+	}
+
+	start = now();
+
+	if (!ring->error && fflush(ring->file) == EOF)
+	{
+		abandonRing(ring, errno);
+	}
+
+	if (!ring->error && ring->holes &&
+	    ftruncate(fileno(ring->file), ftello(ring->file)) == -1)
+	{
+		abandonRing(ring, errno);
+	}
+
+	ring->fileTime += now() - start;
+
+	return NULL;
+}
+
+static void *readRing(void *argument)
+{
+	struct Ring *ring = argument;
+	uint8_t *slot = NULL;
+	uint64_t start = 0;
+	uint32_t run = 0;
+	size_t length = 0;
+
+	while ((slot = claimSlot(ring)) != NULL)
+	{
+		start = now();
+		run = ring->sparse ? skipHole(ring) : 0;
+		length = run > 0 ? ring->length : readSlot(ring, slot);
+		ring->fileTime += now() - start;
+
+		if (length < ring->length)
+		{
+			if (errno)
+			{
+				abandonRing(ring, errno);
+				break;
+			}
+
+			if (!ring->ended)
+			{
+				break;
+			}
+
+			memset(slot + length, 0, ring->length - length);
+		}
+
+		if (run == 0 && ring->sparse && isZeroBlock(slot, ring->length))
+		{
+			run = 1;
+		}
+
+		ring->runs[ring->head] = run;
+
+		if (length > 0)
+		{
+			fillSlot(ring);
+		}
+
+		if (ring->ended)
+		{
+			sealRing(ring);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static size_t readSlot(struct Ring *ring, uint8_t *slot)
+{
+	size_t length = 0;
+
+	errno = 0;
+
+	if (ring->stream)
+	{
+		return readStream(ring, slot);
+	}
+
+	length = fread(slot, 1, ring->length, ring->file);
+	errno = ferror(ring->file) ? (errno ? errno : EIO) : 0;
+
+	ring->ended = feof(ring->file);
+	return length;
+}
+
+/*
+ * Pipes, FIFOs and terminals are read straight from the descriptor, waiting
+ * in poll() alongside the wake pipe, so that sealing the ring stops a reader
+ * whose writer has gone quiet. A short length with neither errno nor ended
+ * set means the ring was sealed.
+ */
+
+static size_t readStream(struct Ring *ring, uint8_t *slot)
+{
+	struct pollfd descriptors[2] =
+	{
+		{fileno(ring->file), POLLIN, 0},
+		{ring->wake[0],      POLLIN, 0}
+	};
+	size_t length = 0;
+	ssize_t received = 0;
+
+	while (length < ring->length)
+	{
+		if (poll(descriptors, 2, -1) == -1)
+		{
+			if (errno == EINTR)
+			{
+				errno = 0;
+				continue;
+			}
+
+			return length;
+		}
+
+		if (descriptors[1].revents)
+		{
+			return length;
+		}
+
+		received = read(descriptors[0].fd, slot + length,
+		                ring->length - length);
+
+		if (received == -1)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+			{
+				errno = 0;
+				continue;
+			}
+
+			return length;
+		}
+
+		if (received == 0)
+		{
+			ring->ended = true;
+			return length;
+		}
+
+		length += received;
+	}
+
+	return length;
+}
+
+static int skipSlot(struct Ring *ring, uint8_t *slot)
+{
+	if (!ring->sparse || !isZeroBlock(slot, ring->length))
+	{
+		return -1;
+	}
+
+	if (fseeko(ring->file, ring->length, SEEK_CUR) == -1)
+	{
+		ring->sparse = false;
+		return -1;
+	}
+
+	ring->holes = true;
+	return 0;
+}
+
+static uint32_t skipHole(struct Ring *ring)
+{
+	int descriptor = fileno(ring->file);
+	off_t offset = ftello(ring->file);
+	off_t data = 0;
+	off_t blocks = 0;
+
+	if (!ring->extents || offset < ring->hole)
+	{
+		return 0;
+	}
+
+	data = lseek(descriptor, offset, SEEK_DATA);
+
+	if (data == -1 && errno == ENXIO)
+	{
+		data = lseek(descriptor, 0, SEEK_END);
+		ring->hole = data;
+	}
+
+	else if (data != -1)
+	{
+		ring->hole = lseek(descriptor, data, SEEK_HOLE);
+	}
+
+	if (data == -1 || ring->hole == -1)
+	{
+		ring->extents = false;
+		fseeko(ring->file, offset, SEEK_SET);
+		return 0;
+	}
+
+	blocks = (data - offset) / ring->length;
+
+	if (data == ring->hole)
+	{
+		blocks = (data - offset + ring->length - 1) / ring->length;
+	}
+
+	if (blocks > UINT32_MAX)
+	{
+		blocks = UINT32_MAX;
+	}
+
+	if (data != ring->hole || blocks == UINT32_MAX)
+	{
+		data = offset + blocks * ring->length;
+	}
+
+	if (fseeko(ring->file, data, SEEK_SET) == -1)
+	{
+		ring->extents = false;
+		return 0;
+	}
+
+	return blocks;
+}
+
+static uint32_t slotRun(struct Ring *ring)
+{
+	return ring->runs[ring->tail];
+}
+
+static bool copySlot(struct Ring *ring, uint32_t *run, uint8_t *target)
+{
+	uint8_t *slot = NULL;
+	uint64_t waited = 0;
+
+	if (*run == 0)
+	{
+		waited = now();
+		slot = drainSlot(ring);
+		Statistics.fileWait += now() - waited;
+
+		if (slot == NULL)
+		{
+			return false;
+		}
+
+		*run = slotRun(ring);
+
+		if (*run == 0)
+		{
+			memcpy(target, slot, ring->length);
+			releaseSlot(ring);
+			return true;
+		}
+
+		releaseSlot(ring);
+	}
+
+	(*run)--;
+	memset(target, 0, ring->length);
+	return true;
+}
+
+static bool isZeroBlock(uint8_t *data, size_t length)
+{
+	if (length == 0)
+	{
+		return true;
+	}
+
+	return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+}
+
+static int openManifest(struct Manifest *manifest, char *filename,
+                        uint32_t block, uint32_t count)
+{
+	char name[PATH_MAX];
+
+	memset(manifest, 0, sizeof(*manifest));
+
+	if (snprintf(name, sizeof(name), "%s.manifest", filename) >=
+	    (int)sizeof(name))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memcpy(manifest->header.magic, MANIFEST_MAGIC,
+	       sizeof(manifest->header.magic));
+	manifest->header.blockLength = BlockLength;
+	manifest->header.chunk       = ManifestChunk;
+	manifest->header.block       = block;
+	manifest->hash               = HASH_SEED;
+	manifest->hashes             = calloc(((size_t)count + ManifestChunk - 1) /
+	                                      ManifestChunk + 1,
+	                                      sizeof(*manifest->hashes));
+
+	if (manifest->hashes == NULL)
+	{
+		return -1;
+	}
+
+	manifest->file = fopen(name, "w");
+
+	if (manifest->file == NULL)
+	{
+		free(manifest->hashes);
+		manifest->hashes = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void addManifest(struct Manifest *manifest, uint8_t *data, bool known)
+{
+	manifest->hash = hashBlock(data, BlockLength, manifest->hash);
+	manifest->unknown |= !known;
+	manifest->header.count++;
+
+	if (++manifest->filled < manifest->header.chunk)
+	{
+		return;
+	}
+
+	manifest->hashes[manifest->entries++] = manifest->unknown ?
+	                                        HASH_UNKNOWN :
+	                                        finishHash(manifest->hash);
+	manifest->hash    = HASH_SEED;
+	manifest->filled  = 0;
+	manifest->unknown = false;
+}
+
+static int closeManifest(struct Manifest *manifest)
+{
+	int status = 0;
+
+	if (manifest->file == NULL)
+	{
+		return 0;
+	}
+
+	if (manifest->filled > 0)
+	{
+		manifest->hashes[manifest->entries++] = manifest->unknown ?
+		                                        HASH_UNKNOWN :
+		                                        finishHash(manifest->hash);
+	}
+
+	if (writeManifest(manifest->file, &manifest->header) == -1)
+	{
+		status = -1;
+	}
+
+	for (size_t entry = 0; status == 0 && entry < manifest->entries; entry++)
+	{
+		if (writeHash(manifest->file, manifest->hashes[entry]) == -1)
+		{
+			status = -1;
+		}
+	}
+
+	if (fclose(manifest->file) == EOF)
+	{
+		status = -1;
+	}
+
+	free(manifest->hashes);
+	manifest->hashes = NULL;
+	manifest->file = NULL;
+	return status;
+}
+
+static int writeManifest(FILE *file, struct ManifestHeader *header)
+{
+	uint8_t data[MANIFEST_HEADER_SIZE];
+
+	memcpy(data, header->magic, sizeof(header->magic));
+	encodeLittleEndian(data +  8, header->blockLength, 4);
+	encodeLittleEndian(data + 12, header->chunk, 4);
+	encodeLittleEndian(data + 16, header->block, 4);
+	encodeLittleEndian(data + 20, header->count, 4);
+
+	return fwrite(data, sizeof(data), 1, file) < 1 ? -1 : 0;
+}
+
+static int readManifest(FILE *file, struct ManifestHeader *header)
+{
+	uint8_t data[MANIFEST_HEADER_SIZE];
+
+	if (fread(data, sizeof(data), 1, file) < 1)
+	{
+		return -1;
+	}
+
+	memcpy(header->magic, data, sizeof(header->magic));
+	header->blockLength = decodeLittleEndian(data +  8, 4);
+	header->chunk       = decodeLittleEndian(data + 12, 4);
+	header->block       = decodeLittleEndian(data + 16, 4);
+	header->count       = decodeLittleEndian(data + 20, 4);
+
+	if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->blockLength != BlockLength || header->chunk == 0 ||
+	    header->chunk > MANIFEST_CHUNK_LIMIT)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static int writeHash(FILE *file, uint64_t hash)
+{
+	uint8_t data[sizeof(hash)];
+
+	encodeLittleEndian(data, hash, sizeof(data));
+	return fwrite(data, sizeof(data), 1, file) < 1 ? -1 : 0;
+}
+
+static int readHash(FILE *file, uint64_t *hash)
+{
+	uint8_t data[sizeof(*hash)];
+
+	if (fread(data, sizeof(data), 1, file) < 1)
+	{
+		return -1;
+	}
+
+	*hash = decodeLittleEndian(data, sizeof(data));
+	return 0;
+}
+
+static void encodeLittleEndian(uint8_t *data, uint64_t value, size_t length)
+{
+	for (size_t index = 0; index < length; index++)
+	{
+		data[index] = value >> (8 * index);
+	}
+}
+
+static uint64_t decodeLittleEndian(uint8_t *data, size_t length)
+{
+	uint64_t value = 0;
+
+	for (size_t index = 0; index < length; index++)
+	{
+		value |= (uint64_t)data[index] << (8 * index);
+	}
+
+	return value;
+}
+
+/*
+ * Every word is folded into the state through a full avalanche, so that a
+ * change to one word spreads over the whole state before the next is mixed
+ * in, and cannot be cancelled by a fixed change to the words that follow.
+ */
+
+static uint64_t hashBlock(uint8_t *data, size_t length, uint64_t hash)
+{
+	size_t index = 0;
+
+	for (; index + sizeof(uint64_t) <= length; index += sizeof(uint64_t))
+	{
+		hash = mixHash(hash ^ decodeLittleEndian(data + index, sizeof(hash)));
+	}
+
+	if (index < length)
+	{
+		hash = mixHash(hash ^ decodeLittleEndian(data + index, length - index) ^
+		               ((uint64_t)(length - index) << 56));
+	}
+
+	return hash;
+}
+
+static uint64_t finishHash(uint64_t hash)
+{
+	hash = mixHash(hash);
+
+	return hash == HASH_UNKNOWN ? ~hash : hash;
+}
+
+static uint64_t mixHash(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccd;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static void interrupt()
+{
+	Interrupted = true;
+}
+
+static int setMode(void)
+{
+	return ioctl(Descriptor, SPI_IOC_WR_MODE, &Mode);
+}
+
+static int setBitsPerWord(void)
+{
+	return ioctl(Descriptor, SPI_IOC_WR_BITS_PER_WORD, &BitsPerWord);
+}
+
+static int parseClockFrequency(char *argument)
+{
+	return parseUInt32(&argument, &ClockFrequency);
+}
+
+static int setClockFrequency(void)
+{
+	return ioctl(Descriptor, SPI_IOC_WR_MAX_SPEED_HZ, &ClockFrequency);
+}
+
+static void slowClock(void)
+{
+	if (!AdaptiveClock)
+	{
+		return;
+	}
+
+	BusFrequency  = ClockFrequency < IDENTIFICATION_FREQUENCY ?
+	                ClockFrequency : IDENTIFICATION_FREQUENCY;
+	CardFrequency = DEFAULT_CARD_FREQUENCY;
+	ClockErrors   = 0;
+	ClockSamples  = 0;
+}
+
+static void rampClock(void)
+{
+	if (!AdaptiveClock)
+	{
+		return;
+	}
+
+	BusFrequency = ClockFrequency < CardFrequency ?
+	               ClockFrequency : CardFrequency;
+	ClockErrors  = 0;
+	ClockSamples = 0;
+}
+
+static void adaptClock(bool failed)
+{
+	if (!AdaptiveClock)
+	{
+		return;
+	}
+
+	ClockSamples++;
+
+	if (failed)
+	{
+		ClockErrors++;
+	}
+
+	if (ClockErrors >= DOWNSHIFT_THRESHOLD &&
+	    BusFrequency > IDENTIFICATION_FREQUENCY)
+	{
+		BusFrequency /= 2;
+
+		if (BusFrequency < IDENTIFICATION_FREQUENCY)
+		{
+			BusFrequency = IDENTIFICATION_FREQUENCY;
+		}
+
+		CardFrequency = BusFrequency;
+		fprintf(stderr, "Clock Downshift: %dHz\n", BusFrequency);
+	}
+
+	if (ClockErrors >= DOWNSHIFT_THRESHOLD || ClockSamples >= DOWNSHIFT_WINDOW)
+	{
+		ClockErrors  = 0;
+		ClockSamples = 0;
+	}
+}
+
+static uint32_t decodeTransferRate(uint8_t transferRate)
+{
+	uint8_t unit = transferRate & 0x07;
+
+	if (unit >= sizeof(TransferUnits) / sizeof(*TransferUnits))
+	{
+		return 0;
+	}
+
+	return TransferUnits[unit] * TimeValues[(transferRate >> 3) & 0x0f];
+}
+
+static void deriveTimeouts(void)
+{
+	static const uint64_t units[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+	                                 10000000};
+	struct CSD1 *csd1 = &Card.csd.data.csd1;
+	uint64_t access = 0;
+	uint64_t read = 0;
+	uint64_t write = 0;
+
+	if (!DeriveTimeouts)
+	{
+		return;
+	}
+
+	ResponseTimeout = 10000;
+	ReadTimeout     = READ_TIMEOUT_LIMIT;
+	WriteTimeout    = SDHC_WRITE_TIMEOUT;
+
+	if (!Card.csdValid || Card.csd.version != CSD1)
+	{
+		return;
+	}
+
+	access = units[csd1->taac & 0x07] * TimeValues[(csd1->taac >> 3) & 0x0f];
+	access = access / 10000 + (uint64_t)csd1->nsac * 100 * 1000000 / BusFrequency;
+	read   = access * 100;
+	write  = read << csd1->writeSpeedFactor;
+
+	ReadTimeout  = read  < READ_TIMEOUT_LIMIT  ? read  + 1 : READ_TIMEOUT_LIMIT;
+	WriteTimeout = write < WRITE_TIMEOUT_LIMIT ? write + 1 : WRITE_TIMEOUT_LIMIT;
+}
+
+static int parseDevice(char *argument)
+{
+	char *filename = NULL;
+
+	if (Device != NULL)
+	{
+		free(Device);
+	}
+
+	if (parseFilename(&argument, &filename) == -1)
+	{
+		return -1;
+	}
+
+	Device = strdup(filename);
+
+	if (Device == NULL)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static int openDevice(void)
+{
+	if (isDeviceOpen())
+	{
+		closeDevice();
+	}
+
+	Descriptor = open(Device, O_RDWR);
+
+	if (Descriptor == -1)
+	{
+		return -1;
+	}
+
+	if (setMode() == -1)
+	{
+		closeDevice();
+		return -1;
+	}
+
+	if (setBitsPerWord() == -1)
+	{
+		closeDevice();
+		return -1;
+	}
+
+	if (setClockFrequency() == -1)
+	{
+		closeDevice();
+		return -1;
+	}
+
+	if (AdaptiveClock)
+	{
+		slowClock();
+	}
+
+	else
+	{
+		BusFrequency = ClockFrequency;
+	}
+
+	return 0;
+}
+
+static bool isDeviceOpen(void)
+{
+	return Descriptor > -1;
+}
+
+static void closeDevice(void)
+{
+	if (isDeviceOpen())
+	{
+		close(Descriptor);
+	}
+
+	Descriptor = -1;
+	discardResidue();
+
+	if (Device != NULL)
+	{
+		free(Device);
+		Device = NULL;
+	}
+}
+
+static int transmitData(uint8_t *request, size_t length, size_t expected)
+{
+	struct spi_ioc_transfer transfers[2] =
+	{
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)request,
+			.len      = length
+		}
+	};
+
+	if (transmitSegments(transfers, 1, expected) == -1)
+	{
+		return -1;
+	}
+
+	if (Verbosity >= Payloads)
+	{
+		printf("TX\n");
+		dump(request, length, stdout);
+	}
+
+	return 0;
+}
+
+static int receiveData(uint8_t *response, size_t length)
+{
+	size_t available = 0;
+
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	if (awaitData(0xff, response, PollWindow + length - 1,
+	              ResponseTimeout, &Statistics.responsePolls) == -1)
+	{
+		return -1;
+	}
+
+	available = Residue.length - Residue.offset;
+
+	if (available > length - 1)
+	{
+		available = length - 1;
+	}
+
+	memcpy(response + 1, Residue.data + Residue.offset, available);
+	Residue.offset += available;
+
+	if (clockData(response + 1 + available, length - 1 - available) == -1)
+	{
+		return -1;
+	}
+
+	if (Verbosity >= Payloads)
+	{
+		printf("RX\n");
+		dump(response, length, stdout);
+	}	
+
+	return 0;
+}
+
+static int awaitData(uint8_t filler, uint8_t *byte, size_t window,
+                     uint32_t timeout, uint64_t *polled)
+{
+	uint64_t deadline = 0;
+
+	while (true)
+	{
+		while (Residue.offset < Residue.length)
+		{
+			*byte = Residue.data[Residue.offset++];
+
+			if (*byte != filler)
+			{
+				return 0;
+			}
+
+			(*polled)++;
+		}
+
+		if (deadline == 0)
+		{
+			deadline = now() + timeout;
+		}
+
+		else if (now() >= deadline)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		if (pollData(window) == -1)
 		{
-			Interrupted = false;
-			break;
+			return -1;
 		}
+	}
+}
 
-		nextBlock(&address);
-		index++;
+static int awaitBusy(bool programming)
+{
+	uint64_t start = 0;
+	uint64_t deadline = 0;
+	size_t window = PollWindow;
+	size_t limit = BusFrequency / 8000;
+
+	while (Residue.offset < Residue.length)
+	{
+		if (Residue.data[Residue.offset++] != NotWritten)
+		{
+			return 0;
+		}
+
+		Statistics.busyBytes++;
 	}
 
-	fclose(file);
-	signal(SIGINT, SIG_DFL);
+	start = now();
+	deadline = start + WriteTimeout;
+
+	if (limit > TRANSFER_LIMIT)
+	{
+		limit = TRANSFER_LIMIT;
+	}
 
-	end = time(NULL);
-	delta = difftime(end, start) + 1;
-	printf("Pulled %d of %d block(s) in +-%ds\n\n", index, count, delta);
+	if (programming && Card.busyEstimate > BUSY_SLEEP_THRESHOLD)
+	{
+		usleep(Card.busyEstimate - Card.busyEstimate / 4);
+	}
 
-	return status;
+	while (true)
+	{
+		if (pollData(window) == -1)
+		{
+			return -1;
+		}
+
+		while (Residue.offset < Residue.length)
+		{
+			if (Residue.data[Residue.offset++] != NotWritten)
+			{
+				uint64_t elapsed = now() - start;
+
+				BusyTime += elapsed;
+				Statistics.busyTime += elapsed;
+
+				if (programming)
+				{
+					Card.busyEstimate += ((int64_t)elapsed -
+					                      Card.busyEstimate) / 8;
+				}
+
+				return 0;
+			}
+
+			Statistics.busyBytes++;
+		}
+
+		if (now() >= deadline)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		if (window < limit)
+		{
+			window *= 2;
+		}
+	}
 }
 
-static void nextBlock(uint32_t *address)
+static int skipData(size_t length)
 {
-	if (HighCapacity)
+	size_t available = Residue.length - Residue.offset;
+
+	if (available >= length)
 	{
-		(*address)++;
+		Residue.offset += length;
+		return 0;
 	}
 
-	else
+	discardResidue();
+	length -= available;
+
+	while (length > TRANSFER_LIMIT)
 	{
-		*address += BlockLength; 
+		if (pollData(TRANSFER_LIMIT) == -1)
+		{
+			return -1;
+		}
+
+		length -= TRANSFER_LIMIT;
+	}
+
+	if (pollData(length) == -1)
+	{
+		return -1;
 	}
+
+	Residue.offset = length;
+	return 0;
 }
 
-static int countBlocks(FILE *file, size_t *count)
+static int pollData(size_t window)
 {
-	long offset = 0;
+	discardResidue();
 
-	if (fseek(file, 0, SEEK_END) == -1)
+	if (window > TRANSFER_LIMIT)
+	{
+		window = TRANSFER_LIMIT;
+	}
+
+	if (reserveResidue(window) == -1)
 	{
 		return -1;
 	}
 
-	offset = ftell(file);
+	if (clockData(Residue.data, window) == -1)
+	{
+		return -1;
+	}
 
-	if (offset == -1)
+	Residue.length = window;
+	return 0;
+}
+
+static int clockData(uint8_t *response, size_t length)
+{
+	struct spi_ioc_transfer transfer =
+	{
+		.speed_hz = BusFrequency,
+		.tx_buf   = (uintptr_t)Filler,
+		.rx_buf   = (uintptr_t)response,
+		.len      = length
+	};
+
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	return exchangeData(&transfer, 1);
+}
+
+static int collectData(uint8_t *destination, size_t length, size_t trailing)
+{
+	size_t available = Residue.length - Residue.offset;
+
+	struct spi_ioc_transfer transfers[2] =
+	{
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)Filler
+		},
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)Filler
+		}
+	};
+
+	if (available > length)
+	{
+		available = length;
+	}
+
+	memcpy(destination, Residue.data + Residue.offset, available);
+	Residue.offset += available;
+
+	if (available == length)
+	{
+		return 0;
+	}
+
+	length -= available;
+
+	if (length >= TRANSFER_LIMIT)
+	{
+		trailing = 0;
+	}
+
+	else if (trailing > TRANSFER_LIMIT - length)
+	{
+		trailing = TRANSFER_LIMIT - length;
+	}
+
+	discardResidue();
+
+	if (reserveResidue(trailing) == -1)
 	{
 		return -1;
 	}
 
-	if (fseek(file, 0, SEEK_SET) == -1)
+	transfers[0].rx_buf = (uintptr_t)(destination + available);
+	transfers[0].len    = length;
+	transfers[1].rx_buf = (uintptr_t)Residue.data;
+	transfers[1].len    = trailing;
+
+	if (exchangeData(transfers, trailing ? 2 : 1) == -1)
 	{
 		return -1;
 	}
 
-	*count = offset / BlockLength;
-	
-	if (offset % BlockLength)
+	Residue.length = trailing;
+	return 0;
+}
+
+static int reserveResidue(size_t length)
+{
+	uint8_t *data = NULL;
+
+	if (Residue.capacity >= length)
 	{
-		(*count)++;
+		return 0;
+	}
+
+	data = realloc(Residue.data, length);
+
+	if (data == NULL)
+	{
+		return -1;
 	}
 
+	Residue.data     = data;
+	Residue.capacity = length;
 	return 0;
 }
 
-static void printBadBlockWarning(uint32_t address)
+static void discardResidue(void)
 {
-	if (!HighCapacity)
+	Residue.offset = 0;
+	Residue.length = 0;
+}
+
+static uint8_t *reserveScratch(size_t length)
+{
+	void *data = NULL;
+
+	if (Scratch.capacity >= length)
 	{
-		address /= BlockLength;
+		return Scratch.data;
 	}
 
-	fprintf(stderr, "Bad Block: %d\n", address);
+	errno = posix_memalign(&data, BUFFER_ALIGNMENT, length);
+
+	if (errno)
+	{
+		return NULL;
+	}
+
+	free(Scratch.data);
+	Scratch.data     = data;
+	Scratch.capacity = length;
+	return Scratch.data;
 }
 
-static void interrupt()
+static int transmitSegments(struct spi_ioc_transfer *transfers, size_t count,
+                            size_t expected)
 {
-	Interrupted = true;
+	size_t length = 0;
+
+	for (size_t index = 0; index < count; index++)
+	{
+		length += transfers[index].len;
+	}
+
+	if (length >= TRANSFER_LIMIT)
+	{
+		expected = 0;
+	}
+
+	else if (expected > TRANSFER_LIMIT - length)
+	{
+		expected = TRANSFER_LIMIT - length;
+	}
+
+	discardResidue();
+
+	if (reserveResidue(expected) == -1)
+	{
+		return -1;
+	}
+
+	if (expected > 0)
+	{
+		memset(&transfers[count], 0, sizeof(transfers[count]));
+		transfers[count].speed_hz = BusFrequency;
+		transfers[count].tx_buf   = (uintptr_t)Filler;
+		transfers[count].rx_buf   = (uintptr_t)Residue.data;
+		transfers[count].len      = expected;
+		count++;
+	}
+
+	if (exchangeData(transfers, count) == -1)
+	{
+		return -1;
+	}
+
+	Residue.length = expected;
+	return 0;
 }
 
-static int setMode(void)
+static int exchangeData(struct spi_ioc_transfer *transfers, size_t count)
 {
-	return ioctl(Descriptor, SPI_IOC_WR_MODE, &Mode);
+	int status = 0;
+	uint64_t start = now();
+
+	transfers[count - 1].cs_change = true;
+	status = ioctl(Descriptor, SPI_IOC_MESSAGE(count), transfers);
+
+	Statistics.spiTime += now() - start;
+	Statistics.ioctls++;
+
+	for (size_t index = 0; index < count; index++)
+	{
+		Statistics.bytes += transfers[index].len;
+	}
+
+	if (Trace.enabled && status != -1)
+	{
+		traceTransfers(transfers, count, start);
+	}
+
+	return status;
 }
 
-static int setBitsPerWord(void)
+static void traceTransfers(struct spi_ioc_transfer *transfers, size_t count,
+                           uint64_t time)
 {
-	return ioctl(Descriptor, SPI_IOC_WR_BITS_PER_WORD, &BitsPerWord);
+	for (size_t index = 0; index < count; index++)
+	{
+		uint8_t *request  = (uint8_t *)(uintptr_t)transfers[index].tx_buf;
+		uint8_t *response = (uint8_t *)(uintptr_t)transfers[index].rx_buf;
+
+		if (request != NULL && request != Filler)
+		{
+			traceData(TraceTX, request, transfers[index].len, time);
+		}
+
+		if (response != NULL)
+		{
+			traceData(TraceRX, response, transfers[index].len, time);
+		}
+	}
 }
 
-static int parseClockFrequency(char *argument)
+static void traceData(uint8_t direction, uint8_t *data, size_t length,
+                      uint64_t time)
 {
-	return parseUInt32(&argument, &ClockFrequency);
+	struct TraceRecord record =
+	{
+		.time      = time,
+		.length    = length,
+		.direction = direction,
+		.command   = Trace.command
+	};
+
+	size_t size = sizeof(record) + length;
+
+	while (Trace.head + size - Trace.tail > TRACE_CAPACITY)
+	{
+		struct TraceRecord oldest;
+
+		readTrace(Trace.tail, &oldest, sizeof(oldest));
+		Trace.tail += sizeof(oldest) + oldest.length;
+	}
+
+	writeTrace(&record, sizeof(record));
+	writeTrace(data, length);
 }
 
-static int setClockFrequency(void)
+static void writeTrace(void *source, size_t length)
 {
-	return ioctl(Descriptor, SPI_IOC_WR_MAX_SPEED_HZ, &ClockFrequency);
+	size_t offset = Trace.head % TRACE_CAPACITY;
+	size_t first = TRACE_CAPACITY - offset;
+
+	if (first > length)
+	{
+		first = length;
+	}
+
+	memcpy(Trace.data + offset, source, first);
+	memcpy(Trace.data, (uint8_t *)source + first, length - first);
+	Trace.head += length;
 }
 
-static int parseDevice(char *argument)
+static void readTrace(uint64_t position, void *destination, size_t length)
 {
-	char *filename = NULL;
+	size_t offset = position % TRACE_CAPACITY;
+	size_t first = TRACE_CAPACITY - offset;
 
-	if (Device != NULL)
+	if (first > length)
 	{
-		free(Device);
+		first = length;
 	}
 
-	if (parseFilename(&argument, &filename) == -1)
+	memcpy(destination, Trace.data + offset, first);
+	memcpy((uint8_t *)destination + first, Trace.data, length - first);
+}
+
+static int saveTrace(char *filename)
+{
+	size_t offset = Trace.tail % TRACE_CAPACITY;
+	size_t length = Trace.head - Trace.tail;
+	size_t first = TRACE_CAPACITY - offset;
+	FILE *file = fopen(filename, "w");
+
+	if (file == NULL)
 	{
 		return -1;
 	}
 
-	Device = strdup(filename);
+	if (first > length)
+	{
+		first = length;
+	}
 
-	if (Device == NULL)
+	if (fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC) - 1, 1, file) < 1 ||
+	    fwrite(Trace.data + offset, 1, first, file) < first ||
+	    fwrite(Trace.data, 1, length - first, file) < length - first)
 	{
+		fclose(file);
 		return -1;
 	}
 
-	return 0;
+	return fclose(file);
 }
 
-static int openDevice(void)
+static void flushTrace(void)
 {
-	if (isDeviceOpen())
+	if (!Trace.enabled || Trace.file == NULL)
 	{
-		closeDevice();
+		return;
+	}
+
+	if (saveTrace(Trace.file) == -1)
+	{
+		fprintf(stderr, "%s: %s\n\n", Trace.file, strerror(errno));
+	}
+}
+
+static int decode(char *filename)
+{
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	struct TraceRecord record;
+	struct Command command = {0};
+	bool commanded = false;
+	uint64_t origin = 0;
+	uint8_t *data = NULL;
+	uint8_t *response = NULL;
+	size_t length = 0;
+	int status = 0;
+	FILE *file = fopen(filename, "r");
+
+	if (file == NULL)
+	{
+		return -1;
+	}
+
+	data     = malloc(UINT16_MAX);
+	response = malloc(TRACE_CAPACITY);
+
+	if (data == NULL || response == NULL)
+	{
+		status = -1;
 	}
 
-	Descriptor = open(Device, O_RDWR);
+	else if (fread(magic, sizeof(magic), 1, file) < 1 ||
+	         memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+	{
+		errno  = EINVAL;
+		status = -1;
+	}
+
+	while (status == 0 && fread(&record, sizeof(record), 1, file) == 1)
+	{
+		bool issued = false;
+
+		if (fread(data, 1, record.length, file) < record.length)
+		{
+			errno  = EINVAL;
+			status = -1;
+			break;
+		}
+
+		if (origin == 0)
+		{
+			origin = record.time;
+		}
+
+		issued = isCommandRecord(&record, data);
+
+		if (issued)
+		{
+			if (commanded)
+			{
+				decodeResponse(&command, response, length);
+			}
+
+			command.type     = data[1] & 0x3f;
+			command.data     = slice(data, 16, 32);
+			command.checksum = data[6] >> 1;
+			commanded        = true;
+			length           = 0;
+		}
 
-	if (Descriptor == -1)
-	{
-		return -1;
-	}
+		else if (record.direction == TraceRX &&
+		         length + record.length <= TRACE_CAPACITY)
+		{
+			memcpy(response + length, data, record.length);
+			length += record.length;
+		}
 
-	if (setMode() == -1)
-	{
-		closeDevice();
-		return -1;
+		printf("%s cmd%d +%.3fms\n",
+		       record.direction == TraceTX ? "TX" : "RX",
+		       record.command, (record.time - origin) / 1000.0);
+		dump(data, record.length, stdout);
+
+		if (issued)
+		{
+			dumpCommand(&command);
+		}
 	}
 
-	if (setBitsPerWord() == -1)
+	if (status == 0 && commanded)
 	{
-		closeDevice();
-		return -1;
+		decodeResponse(&command, response, length);
 	}
 
-	if (setClockFrequency() == -1)
+	if (status == 0 && ferror(file))
 	{
-		closeDevice();
-		return -1;
+		status = -1;
 	}
 
-	return 0;
+	free(response);
+	free(data);
+	fclose(file);
+	return status;
 }
 
-static bool isDeviceOpen(void)
+static bool isCommandRecord(struct TraceRecord *record, uint8_t *data)
 {
-	return Descriptor > -1;
+	return record->direction == TraceTX && record->length == 7 &&
+	       data[0] == 0xff && (data[1] & 0xc0) == 0x40;
 }
 
-static void closeDevice(void)
+static void decodeResponse(struct Command *command, uint8_t *data,
+                           size_t length)
 {
-	if (isDeviceOpen())
+	size_t offset = command->type == 12 ? 1 : 0;
+	enum R1 r1;
+
+	while (offset < length && data[offset] == 0xff)
 	{
-		close(Descriptor);
+		offset++;
 	}
 
-	Descriptor = -1;
-
-	if (Device != NULL)
+	if (offset >= length)
 	{
-		free(Device);
-		Device = NULL;
+		return;
 	}
-}
 
-static int transmitData(uint8_t *request, size_t length)
-{
-	uint8_t response[length];
+	r1 = data[offset++];
+	dumpR1(&r1);
 
-	struct spi_ioc_transfer transfer =
+	switch (command->type)
 	{
-		.speed_hz = ClockFrequency,
-		.tx_buf   = (uintptr_t)request,
-		.rx_buf   = (uintptr_t)response,
-		.len      = length 
-	};
+		case 13:
+			if (offset + 1 <= length)
+			{
+				struct R2 r2 = { .r1 = r1, .status = data[offset] };
+				dumpR2(&r2);
+			}
 
-	memset(response, 0xff, length);
+			break;
 
-	if (exchangeData(&transfer) == -1)
-	{
-		return -1;
-	}
+		case 8:
+			if (offset + 4 <= length)
+			{
+				struct R7 r7 =
+				{
+					.r1      = r1,
+					.voltage = slice(data + offset, 20, 4),
+					.pattern = slice(data + offset, 24, 8)
+				};
+
+				dumpR7(&r7);
+			}
 
-	if (Verbose)
-	{
-		printf("TX\n");
-		dump(request, length, stdout);
-	}
+			break;
 
-	return 0;
+		case 58:
+			if (offset + 4 <= length)
+			{
+				struct R3 r3 = { .r1 = r1, .ocr = slice(data + offset, 0, 32) };
+				dumpR3(&r3);
+			}
+
+			break;
+
+		case 9:
+		case 10:
+		case 17:
+		case 18:
+			decodeBlocks(command->type, data + offset, length - offset);
+			break;
+
+		case 24:
+		case 25:
+			decodeWriteStatus(data + offset, length - offset);
+			break;
+	}
 }
 
-static int receiveData(uint8_t *response, size_t length)
+static void decodeBlocks(uint8_t type, uint8_t *data, size_t length)
 {
-	uint8_t request[length];
+	size_t size = type == 9 || type == 10 ? 16 : BlockLength;
+	size_t offset = 0;
 
-	struct spi_ioc_transfer transfer =
+	while (true)
 	{
-		.speed_hz = ClockFrequency,
-		.tx_buf = (uintptr_t)request,
-		.rx_buf = (uintptr_t)response,
-		.len    = 1
-	};
+		struct Block block = {0};
 
-	memset(response, 0xff, length);
-	memset(request, 0xff, length);
+		while (offset < length && data[offset] == 0xff)
+		{
+			offset++;
+		}
 
-	for (size_t index = 0; index < length; index++)
-	{
-		while (response[index] == 0xff)
+		if (offset >= length)
 		{
-			if (exchangeData(&transfer) == -1)
-			{
-				return -1;
-			}
+			break;
+		}
 
-			if (index > 0)
-			{
-				break;
-			}
+		block.token = data[offset++];
+
+		if (block.token != BlockStart)
+		{
+			displayBlockToken(&block);
+			continue;
 		}
 
-		transfer.tx_buf++;
-		transfer.rx_buf++;
-	}
+		if (offset + size + 2 > length)
+		{
+			break;
+		}
 
-	if (Verbose)
-	{
-		printf("RX\n");
-		dump(response, length, stdout);
-	}	
+		block.data     = data + offset;
+		block.length   = size;
+		block.checksum = slice(data + offset + size, 0, 16);
+		offset        += size + 2;
 
-	return 0;
+		displayBlockToken(&block);
+		displayBlockChecksum(&block);
+
+		if (type == 9)
+		{
+			struct CSD csd = { .r1 = Ready };
+			parseCSD(block.data, &csd);
+			dumpCSD(&csd);
+		}
+
+		else if (type == 10)
+		{
+			struct CID cid = { .r1 = Ready };
+			parseCID(block.data, &cid);
+			dumpCID(&cid);
+		}
+	}
 }
 
-static int exchangeData(struct spi_ioc_transfer *transfer)
+static void decodeWriteStatus(uint8_t *data, size_t length)
 {
-	return ioctl(Descriptor, SPI_IOC_MESSAGE(1), transfer);
+	for (size_t offset = 0; offset < length; offset++)
+	{
+		enum WriteStatus writeStatus;
+
+		if ((data[offset] & 0x11) != 0x01)
+		{
+			continue;
+		}
+
+		writeStatus = (data[offset] >> 1) & 0x07;
+		dumpWriteStatus(&writeStatus);
+	}
 }
 
 static int command(uint8_t commandType, uint32_t data,
                    enum ResponseType responseType, struct Response *response)
 {
-	if (transmitCommand(commandType, data) == -1)
+	size_t expected = measureResponse(responseType);
+
+	if (transmitCommand(commandType, data, expected) == -1)
 	{
 		return -1;
 	}
@@ -1262,20 +6040,25 @@ static int command(uint8_t commandType, uint32_t data,
 	return 0;
 }
 
-
-static int transmitCommand(uint8_t type, uint32_t data)
+static int transmitCommand(uint8_t type, uint32_t data, size_t expected)
 {
 	uint8_t buffer[7];
 	struct Command command = { type, data };
 
 	serialiseCommand(&command, buffer);
+	Trace.command = type;
 
-	if (transmitData(buffer, sizeof(buffer)) == -1)
+	if (expected > TRANSFER_LIMIT - sizeof(buffer))
+	{
+		expected = TRANSFER_LIMIT - sizeof(buffer);
+	}
+
+	if (transmitData(buffer, sizeof(buffer), expected) == -1)
 	{
 		return -1;
 	}
 
-	if (Verbose)
+	if (Verbosity >= Commands)
 	{
 		dumpCommand(&command);
 	}
@@ -1306,19 +6089,76 @@ static void serialiseCommand(struct Command *command, uint8_t *buffer)
 static uint8_t calculateCRC7(uint8_t *data, size_t size)
 {
 	uint8_t crc = 0;
-	uint8_t byte  = 0;
 
 	for (size_t index = 0; index < size; index++)
 	{
-		byte  = data[index] ^ crc;
-		crc = byte >> 4;
-		byte  = byte ^ (crc ^ (crc >> 3));
-		crc = (byte << 1) ^ (byte << 4);
+		crc = CRC7Table[data[index] ^ crc];
 	}
 
 	return crc >> 1;
 }
 
+static void initialiseCRC(void)
+{
+	static uint16_t lookup[] =
+	{
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+	
+		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+	
+		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+	
+		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+	};
+
+	for (int index = 0; index < 256; index++)
+	{
+		uint8_t byte = index;
+		uint8_t crc  = byte >> 4;
+
+		byte = byte ^ (crc ^ (crc >> 3));
+		CRC7Table[index] = (byte << 1) ^ (byte << 4);
+		CRC16Table[0][index] = lookup[index];
+	}
+
+	for (int row = 1; row < 8; row++)
+	{
+		for (int index = 0; index < 256; index++)
+		{
+			uint16_t crc = CRC16Table[row - 1][index];
+			CRC16Table[row][index] = (crc << 8) ^ CRC16Table[0][crc >> 8];
+		}
+	}
+}
+
 static void dumpCommand(struct Command *command)
 {
 	char *label = "Unknown";
@@ -1349,6 +6189,14 @@ static void dumpCommand(struct Command *command)
 			label = "Read CID Register";
 			break;
 
+		case 12:
+			label = "Stop Transmission";
+			break;
+
+		case 13:
+			label = "Send Status";
+			break;
+
 		case 16:
 			label = "Set Block Length";
 			break;
@@ -1357,10 +6205,42 @@ static void dumpCommand(struct Command *command)
 			label = "Read Single Block";
 			break;
 
+		case 23:
+			label = "Set Write Block Erase Count";
+			break;
+
+		case 24:
+			label = "Write Block";
+			break;
+
+		case 25:
+			label = "Write Multiple Block";
+			break;
+
+		case 32:
+			label = "Erase Write Block Start";
+			break;
+
+		case 33:
+			label = "Erase Write Block End";
+			break;
+
+		case 38:
+			label = "Erase";
+			break;
+
+		case 18:
+			label = "Read Multiple Block";
+			break;
+
 		case 41:
 			label = "Send Operating Condition";
 			break;
 
+		case 51:
+			label = "Send SD Configuration Register";
+			break;
+
 		case 55:
 			label = "Begin Application Specific Command";
 			break;
@@ -1369,6 +6249,10 @@ static void dumpCommand(struct Command *command)
 			label = "Read Operating Condition";
 			break;
 
+		case 59:
+			label = "CRC On/Off";
+			break;
+
 		default:
 			break;
 	}
@@ -1379,6 +6263,48 @@ static void dumpCommand(struct Command *command)
 	putchar('\n');
 }
 
+static size_t measureResponse(enum ResponseType type)
+{
+	size_t length = PollWindow + 1;
+
+	switch (type)
+	{
+		case R2:
+			return length + 1;
+
+		case R3:
+		case R7:
+			return length + 4;
+
+		case CSD:
+		case CID:
+			return length + PollWindow + 1 + 16 + 2;
+
+		case Status:
+			return length + PollWindow + 1 + 64 + 2;
+
+		case SDStatus:
+			return length + 1 + PollWindow + 1 + 64 + 2;
+
+		case SCR:
+			return length + PollWindow + 1 + 8 + 2;
+
+		case Block:
+			return length + PollWindow + 1 + BlockLength + 2;
+
+		case Stream:
+			return length + PollWindow;
+
+		case R1b:
+			return length + PollWindow;
+
+		default:
+			break;
+	}
+
+	return length;
+}
+
 static int receiveResponse(enum ResponseType type, struct Response *response)
 {
 	union ResponseData *data = &response->data;
@@ -1389,6 +6315,10 @@ static int receiveResponse(enum ResponseType type, struct Response *response)
 			response->type = R1;
 			return receiveR1(&data->r1);
 
+		case R2:
+			response->type = R2;
+			return receiveR2(&data->r2);
+
 		case R3:
 			response->type = R3;
 			return receiveR3(&data->r3);
@@ -1405,35 +6335,99 @@ static int receiveResponse(enum ResponseType type, struct Response *response)
 			response->type = CID;
 			return receiveCID(&data->cid);
 
+		case SDStatus:
+			response->type = SDStatus;
+			return receiveSDStatus(&data->sdStatus);
+
+		case SCR:
+			response->type = SCR;
+			return receiveSCR(&data->scr);
+
 		case Status:
 			response->type = Block;
+			data->block.data = reserveScratch(64);
+
+			if (data->block.data == NULL)
+			{
+				return -1;
+			}
+
 			return receiveBlock(64, &data->block);
 
 		case Block:
 			response->type = Block;
+			data->block.data = reserveScratch(BlockLength);
+
+			if (data->block.data == NULL)
+			{
+				return -1;
+			}
+
 			return receiveBlock(BlockLength, &data->block);
 
+		case Stream:
+			response->type = R1;
+			return receiveR1(&data->r1);
+
+		case R1b:
+			response->type = R1;
+			return receiveR1b(&data->r1);
+
 		default:
 			break;
 	}
 
-	return -1;
+	return -1;
+}
+
+static int receiveR1(enum R1 *r1)
+{
+	uint8_t buffer[1];
+
+	if (receiveData(buffer, sizeof(buffer)) == -1)
+	{
+		return -1;
+	}
+
+	*r1 = buffer[0];
+
+	if (Verbosity >= Responses)
+	{
+		dumpR1(r1);
+	}
+
+	return 0;
+}
+
+static int receiveR1b(enum R1 *r1)
+{
+	if (receiveR1(r1) == -1)
+	{
+		return -1;
+	}
+
+	return awaitBusy(false);
 }
 
-static int receiveR1(enum R1 *r1)
+static int receiveR2(struct R2 *r2)
 {
 	uint8_t buffer[1];
 
+	if (receiveR1(&r2->r1) == -1)
+	{
+		return -1;
+	}
+
 	if (receiveData(buffer, sizeof(buffer)) == -1)
 	{
 		return -1;
 	}
 
-	*r1 = buffer[0];
+	r2->status = buffer[0];
 
-	if (Verbose)
+	if (Verbosity >= Responses)
 	{
-		dumpR1(r1);
+		dumpR2(r2);
 	}
 
 	return 0;
@@ -1461,7 +6455,10 @@ static int receiveR3(struct R3 *r3)
 	r3->ocr = slice(buffer, 0, 32);
 	HighCapacity = r3->ocr & OCR_CCS;
 
-	if (Verbose)
+	Card.ocr      = r3->ocr;
+	Card.ocrValid = true;
+
+	if (Verbosity >= Responses)
 	{
 		dumpR3(r3);
 	}
@@ -1491,7 +6488,7 @@ static int receiveR7(struct R7 *r7)
 	r7->voltage = slice(buffer, 20, 4);
 	r7->pattern = slice(buffer, 24, 8);
 
-	if (Verbose)
+	if (Verbosity >= Responses)
 	{
 		dumpR7(r7);
 	}
@@ -1501,128 +6498,244 @@ static int receiveR7(struct R7 *r7)
 
 static int receiveCSD(struct CSD *csd)
 {
-	struct Block block;
-	struct CSD1 *csd1;
-	struct CSD2 *csd2;
+	uint8_t data[16] = {0};
+	struct Block block = { .data = data };
 
 	if (receiveBlock(16, &block) == -1)
 	{
 		return -1;
 	}
 
-	csd->r1      = block.r1;
-	csd->version = slice(block.data, 0, 2);
+	csd->r1 = block.r1;
+	parseCSD(block.data, csd);
+
+	if (block.valid)
+	{
+		CardFrequency = decodeTransferRate(slice(block.data, 24, 8));
+
+		if (CardFrequency == 0)
+		{
+			CardFrequency = DEFAULT_CARD_FREQUENCY;
+		}
+
+		rampClock();
+
+		Card.csd      = *csd;
+		Card.csdValid = true;
+		deriveTimeouts();
+	}
+
+	if (Verbosity >= Responses)
+	{
+		dumpCSD(csd);
+	}
+
+	return 0;
+}
+
+static void parseCSD(uint8_t *data, struct CSD *csd)
+{
+	struct CSD1 *csd1;
+	struct CSD2 *csd2;
+
+	csd->version = slice(data, 0, 2);
 
 	if (csd->version == CSD1)
 	{
 		csd1                       = &csd->data.csd1;
-		csd1->taac                 = slice(block.data,   8,  8);
-		csd1->nsac                 = slice(block.data,  16,  8);
-		csd1->transferRate         = slice(block.data,  24,  8);
-		csd1->ccc                  = slice(block.data,  32, 12);
-		csd1->readBlockLength      = slice(block.data,  44,  4);
-		csd1->readBlockPartial     = slice(block.data,  48,  1);
-		csd1->writeBlockMisalign   = slice(block.data,  49,  1);
-		csd1->readBlockMisalign    = slice(block.data,  50,  1);
-		csd1->dsr                  = slice(block.data,  51,  1);
-		csd1->deviceSize           = slice(block.data,  54, 12);
-		csd1->readCurrentVddMin    = slice(block.data,  66,  3);
-		csd1->readCurrentVddMax    = slice(block.data,  69,  3);
-		csd1->writeCurrentVddMin   = slice(block.data,  72,  3);
-		csd1->writeCurrentVddMax   = slice(block.data,  75,  3);
-		csd1->deviceSizeMultiplier = slice(block.data,  78,  3);
-		csd1->eraseBlockEnable     = slice(block.data,  81,  1);
-		csd1->eraseSectorSize      = slice(block.data,  82,  7);
-		csd1->wpGroupSize          = slice(block.data,  89,  7);
-		csd1->wpGroupEnable        = slice(block.data,  96,  1);
-		csd1->writeSpeedFactor     = slice(block.data,  99,  3);
-		csd1->writeBlockLength     = slice(block.data, 102,  4);
-		csd1->writeBlockPartial    = slice(block.data, 106,  1);
-		csd1->fileFormatGroup      = slice(block.data, 112,  1);
-		csd1->copy                 = slice(block.data, 113,  1);
-		csd1->wpPermanent          = slice(block.data, 114,  1);
-		csd1->wpTemporary          = slice(block.data, 115,  1);
-		csd1->fileFormat           = slice(block.data, 116,  2);
-		csd1->checksum             = slice(block.data, 120,  7);
+		csd1->taac                 = slice(data,   8,  8);
+		csd1->nsac                 = slice(data,  16,  8);
+		csd1->transferRate         = slice(data,  24,  8);
+		csd1->ccc                  = slice(data,  32, 12);
+		csd1->readBlockLength      = slice(data,  44,  4);
+		csd1->readBlockPartial     = slice(data,  48,  1);
+		csd1->writeBlockMisalign   = slice(data,  49,  1);
+		csd1->readBlockMisalign    = slice(data,  50,  1);
+		csd1->dsr                  = slice(data,  51,  1);
+		csd1->deviceSize           = slice(data,  54, 12);
+		csd1->readCurrentVddMin    = slice(data,  66,  3);
+		csd1->readCurrentVddMax    = slice(data,  69,  3);
+		csd1->writeCurrentVddMin   = slice(data,  72,  3);
+		csd1->writeCurrentVddMax   = slice(data,  75,  3);
+		csd1->deviceSizeMultiplier = slice(data,  78,  3);
+		csd1->eraseBlockEnable     = slice(data,  81,  1);
+		csd1->eraseSectorSize      = slice(data,  82,  7);
+		csd1->wpGroupSize          = slice(data,  89,  7);
+		csd1->wpGroupEnable        = slice(data,  96,  1);
+		csd1->writeSpeedFactor     = slice(data,  99,  3);
+		csd1->writeBlockLength     = slice(data, 102,  4);
+		csd1->writeBlockPartial    = slice(data, 106,  1);
+		csd1->fileFormatGroup      = slice(data, 112,  1);
+		csd1->copy                 = slice(data, 113,  1);
+		csd1->wpPermanent          = slice(data, 114,  1);
+		csd1->wpTemporary          = slice(data, 115,  1);
+		csd1->fileFormat           = slice(data, 116,  2);
+		csd1->checksum             = slice(data, 120,  7);
 	}
 
 	else if (csd->version == CSD2)
 	{
 		csd2                     = &csd->data.csd2;
-		csd2->taac               = slice(block.data,   8,  8);
-		csd2->nsac               = slice(block.data,  16,  8);
-		csd2->transferRate       = slice(block.data,  24,  8);
-		csd2->ccc                = slice(block.data,  32, 12);
-		csd2->readBlockLength    = slice(block.data,  44,  4);
-		csd2->readBlockPartial   = slice(block.data,  48,  1);
-		csd2->writeBlockMisalign = slice(block.data,  49,  1);
-		csd2->readBlockMisalign  = slice(block.data,  50,  1);
-		csd2->dsr                = slice(block.data,  51,  1);
-		csd2->deviceSize         = slice(block.data,  58, 22);
-		csd2->eraseBlockEnable   = slice(block.data,  81,  1);
-		csd2->eraseSectorSize    = slice(block.data,  82,  7);
-		csd2->wpGroupSize        = slice(block.data,  89,  7);
-		csd2->wpGroupEnable      = slice(block.data,  96,  1);
-		csd2->writeSpeedFactor   = slice(block.data,  99,  3);
-		csd2->writeBlockLength   = slice(block.data, 102,  4);
-		csd2->writeBlockPartial  = slice(block.data, 106,  1);
-		csd2->fileFormatGroup    = slice(block.data, 112,  1);
-		csd2->copy               = slice(block.data, 113,  1);
-		csd2->wpPermanent        = slice(block.data, 114,  1);
-		csd2->wpTemporary        = slice(block.data, 115,  1);
-		csd2->fileFormat         = slice(block.data, 116,  2);
-		csd2->checksum           = slice(block.data, 120,  1);
-	}
-
-	free(block.data);
-
-	if (Verbose)
+		csd2->taac               = slice(data,   8,  8);
+		csd2->nsac               = slice(data,  16,  8);
+		csd2->transferRate       = slice(data,  24,  8);
+		csd2->ccc                = slice(data,  32, 12);
+		csd2->readBlockLength    = slice(data,  44,  4);
+		csd2->readBlockPartial   = slice(data,  48,  1);
+		csd2->writeBlockMisalign = slice(data,  49,  1);
+		csd2->readBlockMisalign  = slice(data,  50,  1);
+		csd2->dsr                = slice(data,  51,  1);
+		csd2->deviceSize         = slice(data,  58, 22);
+		csd2->eraseBlockEnable   = slice(data,  81,  1);
+		csd2->eraseSectorSize    = slice(data,  82,  7);
+		csd2->wpGroupSize        = slice(data,  89,  7);
+		csd2->wpGroupEnable      = slice(data,  96,  1);
+		csd2->writeSpeedFactor   = slice(data,  99,  3);
+		csd2->writeBlockLength   = slice(data, 102,  4);
+		csd2->writeBlockPartial  = slice(data, 106,  1);
+		csd2->fileFormatGroup    = slice(data, 112,  1);
+		csd2->copy               = slice(data, 113,  1);
+		csd2->wpPermanent        = slice(data, 114,  1);
+		csd2->wpTemporary        = slice(data, 115,  1);
+		csd2->fileFormat         = slice(data, 116,  2);
+		csd2->checksum           = slice(data, 120,  1);
+	}
+}
+
+static int receiveCID(struct CID *cid)
+{
+	uint8_t data[16] = {0};
+	struct Block block = { .data = data };
+
+	if (receiveBlock(16, &block) == -1)
 	{
-		dumpCSD(csd);
+		return -1;
+	}
+
+	cid->r1 = block.r1;
+	parseCID(block.data, cid);
+
+	if (block.valid)
+	{
+		Card.cid      = *cid;
+		Card.cidValid = true;
+	}
+
+	if (Verbosity >= Responses)
+	{
+		dumpCID(cid);
 	}
 
 	return 0;
 }
 
-static int receiveCID(struct CID *cid)
+static int receiveSDStatus(struct SDStatus *status)
 {
-	struct Block block;
+	uint8_t data[64] = {0};
+	struct Block block = { .data = data };
 
-	if (receiveBlock(16, &block) == -1)
+	if (receiveR2(&status->r2) == -1)
 	{
 		return -1;
 	}
 
-	cid->r1           = block.r1;
-	cid->manufacturer = block.data[0];
+	if (status->r2.r1 != Ready)
+	{
+		errno = EIO;
+		return -1;
+	}
 
-	memcpy(cid->oem,     block.data + 1, 2);
-	memcpy(cid->product, block.data + 3, 5);
+	if (receiveDataBlock(64, &block) == -1)
+	{
+		return -1;
+	}
 
-	cid->majorRevision = slice(block.data,  64,  4);
-	cid->minorRevision = slice(block.data,  68,  4);
-	cid->serialNumber  = slice(block.data,  72, 32); 
-	cid->reserved      = slice(block.data, 104,  4);
-	cid->year          = slice(block.data, 108,  8);
-	cid->month         = slice(block.data, 116,  4);
-	cid->checksum      = slice(block.data, 120,  7);
+	parseSDStatus(block.data, status);
 
-	free(block.data);
+	if (block.valid)
+	{
+		Card.status      = *status;
+		Card.statusValid = true;
+	}
 
-	if (Verbose)
+	if (Verbosity >= Responses)
 	{
-		dumpCID(cid);
+		dumpSDStatus(status);
 	}
 
 	return 0;
 }
 
-static int receiveBlock(size_t length, struct Block *block)
+static int receiveSCR(struct SCR *scr)
+{
+	uint8_t data[8] = {0};
+	struct Block block = { .data = data };
+
+	if (receiveBlock(8, &block) == -1)
+	{
+		return -1;
+	}
+
+	scr->r1 = block.r1;
+	parseSCR(block.data, scr);
+
+	if (block.valid)
+	{
+		Card.scr      = *scr;
+		Card.scrValid = true;
+	}
+
+	if (Verbosity >= Responses)
+	{
+		dumpSCR(scr);
+	}
+
+	return 0;
+}
+
+static void parseCID(uint8_t *data, struct CID *cid)
+{
+	cid->manufacturer = data[0];
+
+	memcpy(cid->oem,     data + 1, 2);
+	memcpy(cid->product, data + 3, 5);
+
+	cid->majorRevision = slice(data,  64,  4);
+	cid->minorRevision = slice(data,  68,  4);
+	cid->serialNumber  = slice(data,  72, 32); 
+	cid->reserved      = slice(data, 104,  4);
+	cid->year          = slice(data, 108,  8);
+	cid->month         = slice(data, 116,  4);
+	cid->checksum      = slice(data, 120,  7);
+}
+
+static void parseSDStatus(uint8_t *data, struct SDStatus *status)
 {
-	uint8_t buffer[1 + length + 2];
+	status->busWidth        = slice(data,   0,  2);
+	status->securedMode     = slice(data,   2,  1);
+	status->cardType        = slice(data,  16, 16);
+	status->protectedSize   = slice(data,  32, 32);
+	status->speedClass      = slice(data,  64,  8);
+	status->performanceMove = slice(data,  72,  8);
+	status->allocationUnit  = slice(data,  80,  4);
+	status->eraseSize       = slice(data,  88, 16);
+	status->eraseTimeout    = slice(data, 104,  6);
+	status->eraseOffset     = slice(data, 110,  2);
+}
 
-	memset(block, 0, sizeof(*block));
+static void parseSCR(uint8_t *data, struct SCR *scr)
+{
+	scr->structure      = slice(data,  0, 4);
+	scr->specification  = slice(data,  4, 4);
+	scr->erasedOnes     = slice(data,  8, 1);
+	scr->security       = slice(data,  9, 3);
+	scr->busWidths      = slice(data, 12, 4);
+	scr->specification3 = slice(data, 16, 1);
+	scr->commandSupport = slice(data, 30, 2);
+}
 
+static int receiveBlock(size_t length, struct Block *block)
+{
 	if (receiveR1(&block->r1) == -1)
 	{
 		return -1;
@@ -1630,38 +6743,88 @@ static int receiveBlock(size_t length, struct Block *block)
 
 	if (block->r1 != Ready)
 	{
+		errno = EIO;
 		return -1;
 	}
 
-	if (receiveData(buffer, sizeof(buffer)) == -1)
+	return receiveDataBlock(length, block);
+}
+
+static int receiveStreamBlock(size_t length, struct Block *block)
+{
+	block->r1 = Ready;
+	return receiveDataBlock(length, block);
+}
+
+static int receiveDataBlock(size_t length, struct Block *block)
+{
+	uint8_t token = 0;
+	uint8_t checksum[2];
+
+	block->length   = 0;
+	block->checksum = 0;
+	block->valid    = false;
+
+	if (awaitData(0xff, &token, PollWindow, ReadTimeout,
+	              &Statistics.tokenPolls) == -1)
 	{
-		return -1;
+		if (errno != ETIMEDOUT)
+		{
+			return -1;
+		}
+
+		token = 0xff;
 	}
 
-	block->token = buffer[0];
+	block->token = token;
 
-	if (Verbose)
+	if (block->token == BlockStart)
 	{
-		displayBlockToken(block);
+		if (collectData(block->data, length,
+		                sizeof(checksum) + PollWindow) == -1)
+		{
+			return -1;
+		}
+
+		if (collectData(checksum, sizeof(checksum), 0) == -1)
+		{
+			return -1;
+		}
+
+		block->length   = length;
+		block->checksum = slice(checksum, 0, 16);
+		block->valid    = true;
+
+		if (CheckCRC)
+		{
+			uint16_t calculated = 0;
+			calculateCRC16(block->data, length, &calculated);
+			block->valid = calculated == block->checksum;
+
+			if (!block->valid)
+			{
+				Statistics.crcFailures++;
+			}
+		}
 	}
 
-	if (block->token != BlockStart)
+	if (block->token == BlockStart ||
+	    (token != 0xff && (block->token & 0xf0) != 0x00))
 	{
-		return 0;
+		adaptClock(!block->valid);
 	}
 
-	block->data = calloc(1, length);
-
-	if (block->data == NULL)
+	if (Verbosity >= Payloads)
 	{
-		return -1;
+		dumpBlock("RX", block);
 	}
 
-	memcpy(block->data, buffer + 1, length);
-	block->length = length;
-	block->checksum = slice(buffer + 1 + length, 0, 16);
+	else if (Verbosity >= Responses)
+	{
+		displayBlockToken(block);
+	}
 
-	if (Verbose)
+	if (Verbosity >= Responses && block->length > 0)
 	{
 		displayBlockChecksum(block);
 	}
@@ -1671,21 +6834,54 @@ static int receiveBlock(size_t length, struct Block *block)
 
 static int transmitBlock(struct Block *block)
 {
-	uint8_t buffer[1 + block->length];
+	uint8_t token = block->token;
+	uint8_t checksum[2];
+
+	struct spi_ioc_transfer transfers[4] =
+	{
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)&token,
+			.len      = sizeof(token)
+		},
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)block->data,
+			.len      = block->length
+		},
+		{
+			.speed_hz = BusFrequency,
+			.tx_buf   = (uintptr_t)checksum,
+			.len      = sizeof(checksum)
+		}
+	};
 
-	memcpy(buffer, &block->token, 1);
-	memcpy(buffer + 1, block->data, block->length);
+	block->checksum = 0;
+	calculateCRC16(block->data, block->length, &block->checksum);
+	checksum[0] = block->checksum >> 8;
+	checksum[1] = block->checksum;
 
-	if (transmitData(buffer, sizeof(buffer)) == -1)
+	if (transmitSegments(transfers, 3, PollWindow) == -1)
 	{
 		return -1;
 	}
 
-	if (Verbose)
+	if (Verbosity >= Payloads)
+	{
+		dumpBlock("TX", block);
+	}
+
+	else if (Verbosity >= Responses)
 	{
 		displayBlockToken(block);
 	}
 
+	if (Verbosity >= Responses)
+	{
+		display16("Checksum", block->checksum);
+		putchar('\n');
+	}
+
 	return 0;
 }
 
@@ -1700,72 +6896,49 @@ static int receiveWriteStatus(enum WriteStatus *writeStatus)
 
 	*writeStatus = (buffer[0] >> 1) & 0x07;
 
-	if (Verbose)
+	if (*writeStatus == WriteCRCError)
 	{
-		dumpWriteStatus(writeStatus);
+		Statistics.crcFailures++;
 	}
 
-	if (*writeStatus == WriteAccepted)
+	if (*writeStatus == WriteAccepted || *writeStatus == WriteCRCError)
 	{
-		do
-		{
-			if (receiveData(buffer, sizeof(buffer)) == -1)
-			{
-				return -1;
-			}
-		}
-		while (*buffer == NotWritten);
+		adaptClock(*writeStatus == WriteCRCError);
 	}
 
-	return 0;
+	if (Verbosity >= Responses)
+	{
+		dumpWriteStatus(writeStatus);
+	}
+
+	return awaitBusy(*writeStatus == WriteAccepted);
 }
 
 static void calculateCRC16(uint8_t *data, size_t length, uint16_t *checksum)
 {
-	static uint16_t lookup[] =
+	uint16_t crc = *checksum;
+	size_t index = 0;
+
+	for (; index + 8 <= length; index += 8)
 	{
-		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-	
-		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-	
-		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-	
-		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
-	};
+		uint8_t *bytes = data + index;
 
-	for (size_t index = 0; index < length; index++)
+		crc = CRC16Table[7][bytes[0] ^ (crc >> 8)] ^
+		      CRC16Table[6][bytes[1] ^ (crc & 0xff)] ^
+		      CRC16Table[5][bytes[2]] ^
+		      CRC16Table[4][bytes[3]] ^
+		      CRC16Table[3][bytes[4]] ^
+		      CRC16Table[2][bytes[5]] ^
+		      CRC16Table[1][bytes[6]] ^
+		      CRC16Table[0][bytes[7]];
+	}
+
+	for (; index < length; index++)
 	{
-		uint8_t byte = data[index];
-		*checksum = (*checksum << 8) ^ lookup[*checksum >> 8 ^ byte];
+		crc = (crc << 8) ^ CRC16Table[0][(crc >> 8) ^ data[index]];
 	}
+
+	*checksum = crc;
 }
 
 static void dumpR1(enum R1 *r1)
@@ -1814,6 +6987,34 @@ static void dumpR1(enum R1 *r1)
 	putchar('\n');
 }
 
+static void dumpR2(struct R2 *r2)
+{
+	static char *descriptions[] =
+	{
+		"Card Locked", "Lock/Unlock Failed", "Error", "CC Error",
+		"Card ECC Failure", "Write Protect Violation", "Erase Parameter",
+		"Out of Range"
+	};
+
+	char *label = "Card Status";
+
+	if (r2->status == 0)
+	{
+		describe8(label, 0, "OK");
+	}
+
+	for (int bit = 0; bit < 8; bit++)
+	{
+		if (r2->status & (1 << bit))
+		{
+			describe8(label, 1 << bit, descriptions[bit]);
+			label = "";
+		}
+	}
+
+	putchar('\n');
+}
+
 static void dumpR3(struct R3 *r3)
 {
 	if (r3->ocr & OCR_BUSY)
@@ -1999,6 +7200,51 @@ static void dumpCID(struct CID *cid)
 	putchar('\n');
 }
 
+static void dumpSDStatus(struct SDStatus *status)
+{
+	display8("Bus Width", status->busWidth);
+	displayFlag("Secured Mode", status->securedMode);
+	display16("Card Type", status->cardType);
+	display32("Protected Area Size", status->protectedSize);
+	display8("Speed Class", status->speedClass);
+	display8("Performance Move", status->performanceMove);
+	display8("Allocation Unit Size", status->allocationUnit);
+	display16("Erase Size", status->eraseSize);
+	display8("Erase Timeout", status->eraseTimeout);
+	display8("Erase Offset", status->eraseOffset);
+	putchar('\n');
+}
+
+static void dumpSCR(struct SCR *scr)
+{
+	display8("SCR Structure", scr->structure);
+	display8("SD Specification", scr->specification);
+	displayFlag("Erases To 0xff", scr->erasedOnes);
+	display8("Security", scr->security);
+	display8("Bus Widths", scr->busWidths);
+	displayFlag("SD Specification 3", scr->specification3);
+	display8("Command Support", scr->commandSupport);
+	putchar('\n');
+}
+
+static void dumpBlock(char *direction, struct Block *block)
+{
+	uint8_t buffer[1 + block->length + 2];
+
+	buffer[0] = block->token;
+
+	if (block->length > 0)
+	{
+		memcpy(buffer + 1, block->data, block->length);
+		buffer[1 + block->length] = block->checksum >> 8;
+		buffer[2 + block->length] = block->checksum;
+	}
+
+	printf("%s\n", direction);
+	dump(buffer, block->length > 0 ? sizeof(buffer) : 1, stdout);
+	displayBlockToken(block);
+}
+
 static void displayBlockToken(struct Block *block)
 {
 	char *description = "Unknown";
@@ -2021,6 +7267,14 @@ static void displayBlockToken(struct Block *block)
 			description = "Out of Range";
 			break;
 
+		case BlockStartMultiple:
+			description = "Multiple Block Start";
+			break;
+
+		case BlockStopMultiple:
+			description = "Stop Transmission";
+			break;
+
 		case BlockStart:
 			description = "Block Start";
 			break;
@@ -2106,6 +7360,52 @@ static void displayMiliseconds(char *label, uint32_t value)
 	printf("  %-32s%dms\n", label, value);
 }
 
+static void displayMicroseconds(char *label, uint64_t value)
+{
+	printf("  %-32s%.3fms\n", label, value / 1000.0);
+}
+
+static void displayCount(char *label, uint64_t value)
+{
+	printf("  %-32s%" PRIu64 "\n", label, value);
+}
+
+static void displayVerbosity(char *label, uint8_t value)
+{
+	char *description = "Unknown";
+
+	switch (value)
+	{
+		case Quiet:
+			description = "Quiet";
+			break;
+
+		case Commands:
+			description = "Commands";
+			break;
+
+		case Responses:
+			description = "Responses";
+			break;
+
+		case Payloads:
+			description = "Payloads";
+			break;
+	}
+
+	displayString(label, description);
+}
+
+static void displayBytes(char *label, uint64_t value)
+{
+	printf("  %-32s%" PRIu64 " bytes\n", label, value);
+}
+
+static void displayBlocks(char *label, uint32_t value)
+{
+	printf("  %-32s%d block(s)\n", label, value);
+}
+
 static void display8(char *label, uint8_t value)
 {
 	printf("  %-32s0x%02x\n", label, value);
@@ -2133,48 +7433,65 @@ static void describe32(char *label, uint32_t value, char *description)
 
 static void dump(uint8_t *buffer, size_t length, FILE *stream)
 {
-	for (int offset = 0; offset < length; offset += 16)
+	static const char digits[] = "0123456789abcdef";
+	char text[DUMP_LINES * DUMP_LINE_LENGTH + 1];
+	char *cursor = text;
+
+	for (size_t offset = 0; offset < length; offset += 16)
 	{
-		int remaining = 16;
+		size_t remaining = length - offset < 16 ? length - offset : 16;
 
-		if (offset + 16 >= length)
+		*cursor++ = ' ';
+		*cursor++ = ' ';
+
+		for (int shift = 28; shift >= 0; shift -= 4)
 		{
-			remaining = length - offset;
+			*cursor++ = digits[(offset >> shift) & 0x0f];
 		}
 
-		fprintf(stream, "  %08x: ", offset);
+		*cursor++ = ':';
+		*cursor++ = ' ';
 
-		for (int index = 0; index < 16; index++)
+		for (size_t index = 0; index < 16; index++)
 		{
 			if (index < remaining)
 			{
 				uint8_t byte = buffer[offset + index];
-				fprintf(stream, "%02x", byte);
+				*cursor++ = digits[byte >> 4];
+				*cursor++ = digits[byte & 0x0f];
 			}
 
 			else
 			{
-				fprintf(stream, "  ");
+				*cursor++ = ' ';
+				*cursor++ = ' ';
 			}
 
 			if (index % 2)
 			{
-				fputc(' ', stream);
+				*cursor++ = ' ';
 			}
 		}
 
-		fputc(' ', stream);
+		*cursor++ = ' ';
 
-		for (int index = 0; index < remaining; index++)
+		for (size_t index = 0; index < remaining; index++)
 		{
 			uint8_t byte = buffer[offset + index];
-			fputc(isprint(byte) ? byte : '.', stream);
+			*cursor++ = byte >= 0x20 && byte < 0x7f ? byte : '.';
 		}
 
-		fputc('\n', stream);
+		*cursor++ = '\n';
+
+		if (cursor - text > sizeof(text) - DUMP_LINE_LENGTH - 1)
+		{
+			fwrite(text, 1, cursor - text, stream);
+			cursor = text;
+		}
 	}
 
-	fputc('\n', stream);
+	*cursor++ = '\n';
+	fwrite(text, 1, cursor - text, stream);
 }
 
 static int parseUInt16(char **cursor, uint16_t *destination)